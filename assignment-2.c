@@ -1,10 +1,18 @@
 /**
  * Assignment #2: Loops, functions, arrays.
  * This program computes simple DNA matching between 2 sequences.
+ *
+ * The matching is done by dna_match.c, build with
+ * "gcc assignment-2.c dna_match.c dna_pack.c".
  **/
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+
+#include "dna_match.h"
+#include "dna_pack.h"
 
 #define BASE_SEQ_LEN 20
 #define TARGET_SEQ_LEN 5
@@ -35,17 +43,104 @@ _Bool match(const char[], const char[], int, int, int);
 void print_sequence_part(const char[], int, int);
 void print_sequence(const char[], int);
 _Bool is_valid_base(char);
+int scan_targets(int);
+void scan_hit(void *, int, int);
+int match_stream(void);
+int match_batch(int, int, int, int);
+void pack_output_close(void);
 
 /* external variables */
 const char bases[] = {'A', 'T', 'C', 'G'};
+struct dna_pack_writer *pack_output = NULL;   // "-o", see dna_pack.h
 
 /**
  * main: This function needs to read and store a sequence of length
  *       BASE_SEQ_LEN. Then it needs to read and store a sequence of 
  *       TARGET_SEQ_LEN. Finally it needs to call match() with both sequences.
+ *
+ *       "-m <targets>" reads that many targets first and then looks for all
+ *       of them in every base sequence of the input, see scan_targets().
+ *       "-s" reads the target and then matches it against the rest of the
+ *       input as one base sequence of any length, see match_stream().
+ *       "-a <bases> <targets>" reads that many bases and targets and
+ *       matches every base against every target, see match_batch().  Its
+ *       sketches use "-k <k>" bases a k-mer and "-w <w>" k-mers a window.
+ *       "-o <file>" writes merged sequences 2 bits a base to a packed file
+ *       instead of printing them, dna_unpack prints them back.  Options
+ *       can come in any order but only one of -m, -s and -a is allowed.
 **/
-int main() {
+int main(int argc, char *argv[]) {
     char s1[20], s2[5];
+    int num_bases = 0, num_targets = 0;
+    int k = THRESHOLD, w = 1;   // every overlap of THRESHOLD is seen
+    int num_scan = 0;           // "-m"
+    bool stream = false;        // "-s"
+    const char *pack_path = NULL;
+
+    // every option is read before anything runs so their order does not matter
+    for (int i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+        num_scan = atoi(argv[++i]);
+        if (num_scan <= 0) {
+          printf("ERROR: Bad number of targets specified.\n");
+          exit(EXIT_FAILURE);
+        }
+      } else if (strcmp(argv[i], "-s") == 0) {
+        stream = true;
+      } else if (strcmp(argv[i], "-a") == 0 && i + 2 < argc) {
+        num_bases = atoi(argv[++i]);
+        num_targets = atoi(argv[++i]);
+        if (num_bases <= 0 || num_targets <= 0) {
+          printf("ERROR: Bad number of sequences specified.\n");
+          exit(EXIT_FAILURE);
+        }
+      } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+        k = atoi(argv[++i]);
+        if (k <= 0 || k > DNA_SKETCH_MAX_K || k > TARGET_SEQ_LEN) {
+          printf("ERROR: Bad k-mer length specified.\n");
+          exit(EXIT_FAILURE);
+        }
+      } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+        w = atoi(argv[++i]);
+        if (w <= 0 || w > DNA_SKETCH_MAX_W) {
+          printf("ERROR: Bad window length specified.\n");
+          exit(EXIT_FAILURE);
+        }
+      } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+        pack_path = argv[++i];
+      } else {
+        printf("ERROR: Usage: %s [-m <targets> | -s | -a <bases> <targets> [-k <k>] [-w <w>]] [-o <file>]\n",
+               argv[0]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    if ((num_scan > 0) + stream + (num_bases > 0) > 1) {
+      printf("ERROR: Only one of -m, -s and -a can be given.\n");
+      exit(EXIT_FAILURE);
+    }
+    if (pack_path != NULL && (num_scan > 0 || stream)) {
+      printf("ERROR: -o cannot be used with -m or -s.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    if (pack_path != NULL) {
+      pack_output = dna_pack_create(pack_path);
+      if (pack_output == NULL) {
+        printf("ERROR: Unable to create packed file %s.\n", pack_path);
+        exit(EXIT_FAILURE);
+      }
+      // the index is written however the program ends
+      atexit(pack_output_close);
+    }
+    if (num_scan > 0) {
+      return scan_targets(num_scan);
+    }
+    if (stream) {
+      return match_stream();
+    }
+    if (num_bases > 0) {
+      return match_batch(num_bases, num_targets, k, w);
+    }
 
     // 1: Read base input sequence into s1 array
     if (read_sequence(s1, 20) == 0) {
@@ -115,8 +210,11 @@ _Bool read_sequence(char s[], int seq_len) {
 
     printf("Enter a sequence of length %d: ", seq_len);
 
-    // Read first character in to get us started
-    scanf("%c", &b);
+    // Read first character in to get us started, the end of the input
+    // ends the line
+    if (scanf("%c", &b) != 1) {
+      b = '\n';
+    }
 
     // Loop until new line where char b is checked if it's a valid base.
     while (b != '\n') {
@@ -128,7 +226,9 @@ _Bool read_sequence(char s[], int seq_len) {
 
       }
 
-      scanf("%c", &b);
+      if (scanf("%c", &b) != 1) {
+        b = '\n';
+      }
 
     }
 
@@ -243,74 +343,269 @@ _Bool is_valid_base(char b) {
  ****************************************************************************/
 _Bool match(const char s1[], const char s2[], int len1, int len2, int threshold) {
 
-       int i;
-       int j;
+   struct dna_match m;
 
-   // Implemented the match function where matching DNA sequences are concanated. 
-   // It goes through s1[] and s2[] through a for loop to find any matching DNA sequences with the given threshold. 
-   
-   int index_of_s1 = (len1 - threshold);
-   int index_of_s2 = (len2 - threshold);
-   
-   for(i = index_of_s1; i >= 0; i--) {
+   // The matching itself is done by dna_match, which tells how the
+   // sequences line up and where the merged sequence comes from
+   if (!dna_match(s1, s2, len1, len2, threshold, &m)) {
 
-     for(j = 0; j < len2; j++){
+     printf("No match found.\n");
+     return 0;
 
-       if (i + j >= len1) {
-         
-         printf("A match was found.\n");
-         print_sequence_part(s1, 0, len1);
-         print_sequence_part(s2, j, len2);
-         return 1; 
+   }
 
-       }
-       else if (j == (len2 - 1)) {
-         
-         printf("A match was found.\n");
-         print_sequence(s1, len1);
-         return 1;
+   printf("A match was found.\n");
+   if (pack_output != NULL) {
 
-         }
+     if (!dna_pack_write(pack_output, m.head, m.head_len, m.tail, m.tail_len)) {
+       printf("ERROR: Unable to write the packed file.\n");
+       exit(EXIT_FAILURE);
+     }
 
-       else if (s1[i + j] != s2[j]){
+   }
+   else if (m.kind == DNA_MATCH_CONTAINED) {
 
-         break;
+     print_sequence(m.head, m.head_len);
 
-       }
-     }
    }
+   else {
 
-   // Bonus: implemented the match function where s1 and s2 is read from left to right.
-   for(i = index_of_s2; i >= 0; i--){
+     print_sequence_part(m.head, 0, m.head_len);
+     print_sequence_part(m.tail, 0, m.tail_len);
 
-     for(j = 0; j < len2; j++){
+   }
+   return 1;
 
-       if (i + j >= len2){
+}
 
-         printf("A match was found.\n");
-         print_sequence_part(s2, 0, len2);
-         print_sequence_part(s1, j, len1);
-         return 1;
 
-        }
+/* Targets of a scan, TARGET_SEQ_LEN bases each, for printing its hits */
+struct scan_state {
+    const char *targets;
+    long found;
+};
 
-        else if (j == (len2 - 1)) {
+/****************************************************************************
+ * Prints target number target found at offset of the base sequence.        *
+ ****************************************************************************/
+void scan_hit(void *arg, int target, int offset) {
+    struct scan_state *state = arg;
 
-          printf("A match was found.\n");
-          print_sequence(s1, len1);
-          return 1;
+    printf("Target %d ", target + 1);
+    print_sequence_part(state->targets + (long)target * TARGET_SEQ_LEN, 0, TARGET_SEQ_LEN);
+    printf(" found at offset %d.\n", offset);
+    state->found++;
+}
 
-        }
+/****************************************************************************
+ *  Reads num_targets target sequences and compiles them into one           *
+ *  Aho-Corasick automaton (see dna_match.h).  Then reads base sequences    *
+ *  until the input ends and streams each of them through the automaton    *
+ *  once, printing every target it contains with every offset it is at in  *
+ *  the order they end, or "No match found." if there is none.  Each base   *
+ *  is looked at once however many targets there are.                       *
+ *                                                                          *
+ *  Only whole targets are looked for, all of their bases are compared.     *
+ *  Returns 1 if any base contained a target.                               *
+ ****************************************************************************/
+int scan_targets(int num_targets) {
+    char *targets = malloc((size_t)num_targets * TARGET_SEQ_LEN);
+    const char **starts = malloc(sizeof(char *) * num_targets);
+    int *lens = malloc(sizeof(int) * num_targets);
+    struct scan_state state = {targets, 0};
+    struct dna_automaton *ac;
+    char s1[BASE_SEQ_LEN];
+    int c;
+
+    if (targets == NULL || starts == NULL || lens == NULL) {
+      printf("ERROR: Unable to allocate %d targets.\n", num_targets);
+      exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < num_targets; t++) {
+      starts[t] = targets + (long)t * TARGET_SEQ_LEN;
+      lens[t] = TARGET_SEQ_LEN;
+      if (read_sequence(targets + (long)t * TARGET_SEQ_LEN, TARGET_SEQ_LEN) == 0) {
+        printf("ERROR: target %d is bad.  Exiting\n", t + 1);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    ac = dna_automaton_create(starts, lens, num_targets);
+    if (ac == NULL) {
+      printf("ERROR: Unable to allocate %d targets.\n", num_targets);
+      exit(EXIT_FAILURE);
+    }
+
+    // One base sequence per line until the input ends
+    while ((c = getchar()) != EOF) {
+      ungetc(c, stdin);
+      if (read_sequence(s1, BASE_SEQ_LEN) == 0) {
+        continue;
+      }
+      if (dna_automaton_scan(ac, s1, BASE_SEQ_LEN, scan_hit, &state) == 0) {
+        printf("No match found.\n");
+      }
+    }
+
+    dna_automaton_destroy(ac);
+    free(lens);
+    free(starts);
+    free(targets);
+    return state.found > 0;
+}
 
-        else if (s2[i + j] != s1[j]) {
 
-          break;
+/****************************************************************************
+ *  Reads a target sequence and then matches it against the rest of the     *
+ *  input as a single base sequence of any length, such as the output of a  *
+ *  sequencer that keeps running.  Bases are looked at as they arrive and   *
+ *  only the last TARGET_SEQ_LEN of them are kept (see dna_stream in        *
+ *  dna_match.h), so every occurrence of the target is printed as soon as   *
+ *  its last base is read.  Characters that are not bases are ignored.      *
+ *                                                                          *
+ *  When the input ends the match is reported the way match() would, but    *
+ *  as the base is not kept its merged sequence is described instead of     *
+ *  printed.  Returns 1 if a match was found.                               *
+ ****************************************************************************/
+int match_stream(void) {
+    char s2[TARGET_SEQ_LEN];
+    struct dna_stream *ds;
+    struct dna_stream_match m;
+    long offset;
+    int c;
+
+    if (read_sequence(s2, TARGET_SEQ_LEN) == 0) {
+      printf("ERROR: sequence 2 is bad.  Exiting\n");
+      return -1;
+    }
+    ds = dna_stream_create(s2, TARGET_SEQ_LEN, THRESHOLD);
+    if (ds == NULL) {
+      printf("ERROR: Unable to allocate the stream.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    while ((c = getchar()) != EOF) {
+      if (dna_stream_push(ds, (char)c, &offset)) {
+        printf("Target found at offset %ld.\n", offset);
+      }
+    }
+
+    if (!dna_stream_end(ds, &m)) {
+      printf("No match found.\n");
+      dna_stream_destroy(ds);
+      return 0;
+    }
+
+    printf("A match was found.\n");
+    if (m.kind == DNA_MATCH_CONTAINED) {
+      printf("The target is inside the base at offset %ld.\n", m.offset);
+    }
+    else if (m.kind == DNA_MATCH_BASE_TARGET) {
+      printf("The base ends with the first %d bases of the target, followed by ", m.overlap);
+      print_sequence_part(s2, m.overlap, TARGET_SEQ_LEN);
+      printf(".\n");
+    }
+    else {
+      printf("The base starts with the last %d bases of the target, after ", m.overlap);
+      print_sequence_part(s2, 0, (int)m.offset);
+      printf(".\n");
+    }
+    dna_stream_destroy(ds);
+    return 1;
+}
+
+
+/****************************************************************************
+ *  Reads num_bases base sequences and then num_targets target sequences    *
+ *  and matches every base against every target, printing the merged       *
+ *  sequence of each pair that matches and a count of the pairs at the end. *
+ *                                                                          *
+ *  Most pairs of a batch do not match, so each sequence is sketched once   *
+ *  (see dna_sketch in dna_match.h) and a pair is only compared if their    *
+ *  sketches share a minimizer.  With k + w - 1 <= THRESHOLD no match is    *
+ *  lost; larger k and w compare fewer pairs but can miss short overlaps.   *
+ *  Returns 1 if any pair matched.                                          *
+ ****************************************************************************/
+int match_batch(int num_bases, int num_targets, int k, int w) {
+    char *s1 = malloc((size_t)num_bases * BASE_SEQ_LEN);
+    char *s2 = malloc((size_t)num_targets * TARGET_SEQ_LEN);
+    uint64_t *sketch1 = malloc(sizeof(uint64_t) * num_bases * (BASE_SEQ_LEN - k + 1));
+    uint64_t *sketch2 = malloc(sizeof(uint64_t) * num_targets * (TARGET_SEQ_LEN - k + 1));
+    int *len1 = malloc(sizeof(int) * num_bases);
+    int *len2 = malloc(sizeof(int) * num_targets);
+    long compared = 0, matched = 0;
+
+    if (s1 == NULL || s2 == NULL || sketch1 == NULL || sketch2 == NULL
+        || len1 == NULL || len2 == NULL) {
+      printf("ERROR: Unable to allocate %d bases and %d targets.\n", num_bases, num_targets);
+      exit(EXIT_FAILURE);
+    }
 
+    for (int i = 0; i < num_bases; i++) {
+      if (read_sequence(s1 + (long)i * BASE_SEQ_LEN, BASE_SEQ_LEN) == 0) {
+        printf("ERROR: base %d is bad.  Exiting\n", i + 1);
+        exit(EXIT_FAILURE);
+      }
+      len1[i] = dna_sketch(s1 + (long)i * BASE_SEQ_LEN, BASE_SEQ_LEN, k, w,
+                           sketch1 + (long)i * (BASE_SEQ_LEN - k + 1));
+    }
+    for (int j = 0; j < num_targets; j++) {
+      if (read_sequence(s2 + (long)j * TARGET_SEQ_LEN, TARGET_SEQ_LEN) == 0) {
+        printf("ERROR: target %d is bad.  Exiting\n", j + 1);
+        exit(EXIT_FAILURE);
+      }
+      len2[j] = dna_sketch(s2 + (long)j * TARGET_SEQ_LEN, TARGET_SEQ_LEN, k, w,
+                           sketch2 + (long)j * (TARGET_SEQ_LEN - k + 1));
+    }
+
+    for (int i = 0; i < num_bases; i++) {
+      for (int j = 0; j < num_targets; j++) {
+        struct dna_match m;
+
+        if (!dna_sketch_share(sketch1 + (long)i * (BASE_SEQ_LEN - k + 1), len1[i],
+                              sketch2 + (long)j * (TARGET_SEQ_LEN - k + 1), len2[j])) {
+          continue;
+        }
+        compared++;
+        if (!dna_match(s1 + (long)i * BASE_SEQ_LEN, s2 + (long)j * TARGET_SEQ_LEN,
+                       BASE_SEQ_LEN, TARGET_SEQ_LEN, THRESHOLD, &m)) {
+          continue;
         }
+        printf("Base %d and target %d: ", i + 1, j + 1);
+        if (pack_output != NULL) {
+          if (!dna_pack_write(pack_output, m.head, m.head_len, m.tail, m.tail_len)) {
+            printf("ERROR: Unable to write the packed file.\n");
+            exit(EXIT_FAILURE);
+          }
+          printf("record %ld\n", matched);
+        } else {
+          print_sequence_part(m.head, 0, m.head_len);
+          print_sequence(m.tail, m.tail_len);
+        }
+        matched++;
       }
-   }
+    }
+    printf("%ld pairs, %ld compared, %ld matched.\n",
+           (long)num_bases * num_targets, compared, matched);
+
+    free(len2);
+    free(len1);
+    free(sketch2);
+    free(sketch1);
+    free(s2);
+    free(s1);
+    return matched > 0;
+}
 
-    printf("No match found.\n");
-    return 0;
 
-}
\ No newline at end of file
+/****************************************************************************
+ * Finishes the packed file of "-o" when the program ends, see atexit.     *
+ ****************************************************************************/
+void pack_output_close(void) {
+    struct dna_pack_writer *w = pack_output;
+
+    pack_output = NULL;
+    if (w != NULL && !dna_pack_close(w)) {
+      printf("ERROR: Unable to write the packed file.\n");
+    }
+}
@@ -1,190 +1,538 @@
 /**
  * Assignment #3: Strings, structs, pointers, command-line arguments.
  *  Let's use our knowledge to write a simple flight management system!
+ *
+ * This file is the command line front end: it reads commands, prints
+ * the responses and runs the server, generator and replay modes.  The
+ * schedules themselves live in the flight engine, flight_engine.c.
  **/
 
+#define _POSIX_C_SOURCE 200809L  // clock_gettime
+
+// Build with "gcc assignment-3.c flight_engine.c -pthread -lm", the bulk
+// loader parses files on several threads and the workload generator
+// draws from a Zipf distribution
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <assert.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/resource.h>
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+#include "flight_engine.h"
 
 // Limit constants
-#define MAX_CITY_NAME_LEN 20
-#define MAX_FLIGHTS_PER_CITY 5
 #define MAX_DEFAULT_SCHEDULES 50
 
-// Time definitions
-#define TIME_MIN 0
-#define TIME_MAX ((60 * 24)-1)
-#define TIME_NULL -1
-
+// Response writer definitions
+#define OUT_BUFFER_SIZE (1 << 16)  // bytes buffered before writing stdout
+
+// Bulk loader definitions
+#define MAX_PATH_LEN 1024          // longest file name of a bulk load
+
+// Server definitions
+#define SERVER_MAX_EVENTS 256      // events handled per epoll_wait
+#define SERVER_READ_SIZE 65536     // bytes read from a client at a time
+#define SERVER_MAX_COMMAND 65536   // longest command a client may send, a
+                                   // batch of about 1500 requests
+#define SERVER_BENCH_DEPTH 64      // requests in flight per benchmark client
+#define SERVER_OUT_HIGH (1 << 20)  // unsent bytes at which a client's input
+                                   // is left unread until they go out
+#define SERVER_OUT_MAX (64 << 20)  // unsent bytes at which a client is dropped
+
+// Workload generator definitions
+#define GEN_CITIES 1000            // cities in a generated workload
+#define GEN_ZIPF_S 1.1             // skew of the popularity of cities
+#define GEN_DAYS 7                 // days ahead flights are added for
+#define GEN_BURST_MEAN 40          // average length of a booking burst
+#define GEN_CLOCK_EVERY 500        // commands between clock advances
+
+// Statistics definitions, only used when built with -DFLIGHT_STATS
+#define STATS_COMMAND_LETTERS "ALlarsuRbTHPF"  // commands that are timed
+#define STATS_COMMANDS (sizeof(STATS_COMMAND_LETTERS) - 1)
 
 /******************************************************************************
- * Structure and Type definitions                                             *
+ * Global / External variables                                                *
  ******************************************************************************/
-typedef int time_t;                        // integers used for time values
-typedef char city_t[MAX_CITY_NAME_LEN+1];; // null terminate fixed length city
- 
-// Structure to hold all the information for a single flight
-//   A city's schedule has an array of these
-struct flight {
-  time_t time;       // departure time of the flight
-  int available;  // number of seats currently available on the flight
-  int capacity;   // maximum seat capacity of the flight
+// The schedules every command works on
+struct flight_engine *engine = NULL;
+
+// The last snapshot taken with S, queried with V
+struct flight_snapshot *snapshot = NULL;
+
+// Local midnight of the day the program started when the clock follows
+// the wall clock (-w), otherwise 0 and the clock only moves with C
+time_t wall_clock_origin = 0;
+
+// Where commands are read from.  Interactively buf is NULL and commands
+// come from stdin.  In server mode they come from the bytes a client has
+// sent so far, which always hold the whole command being executed.
+struct cmd_input {
+  const char *buf;  // pipelined requests or NULL for stdin
+  size_t len;       // number of bytes in buf
+  size_t pos;       // number of bytes of buf consumed
+};
+struct cmd_input cmd_in;
+
+// The name city_get last read, for the messages about a city that was
+// never added and so has no id
+city_t city_input;
+
+// Responses are formatted into a reusable buffer with hand rolled
+// number formatting instead of a printf per field.  The stdout buffer is
+// written out when it fills up (after every command when a person is
+// typing at a terminal), a server client's buffer grows until the
+// batch of responses is sent.
+struct out_buffer {
+  char *buf;
+  size_t len;     // bytes waiting in buf
+  size_t cap;     // size of buf
+  int fd;         // where a full buffer is written or -1 to grow it
+  bool binary;    // responses use the binary format below
+  int text_fd;    // fd while a REPLY_TEXT record is being written
+};
+struct out_buffer stdout_buffer = { NULL, 0, 0, STDOUT_FILENO, false, -1 };
+
+// Where responses are written: stdout_buffer or the buffer of a client
+struct out_buffer *cmd_out = &stdout_buffer;
+
+// Binary response format for machine clients, selected with "M 1".
+// Every response is a record starting with one of these codes followed
+// by its fields in order.  Integers are 32 bit little endian (seat totals
+// of REPLY_HOUR_SEATS and snapshot versions are 64 bit, low half first),
+// a city is a length byte followed by
+// that many bytes of name and REPLY_TEXT carries free text as a 32 bit
+// length followed by the text.  Every list of records, even an empty
+// one, ends with REPLY_LIST_END.
+enum reply_code {
+  REPLY_TEXT = 1,              // text
+  REPLY_COMMAND_BAD,           //
+  REPLY_CITY_BAD,              // city
+  REPLY_CITY_EXISTS,           // city
+  REPLY_SCHEDULE_NO_FREE,      //
+  REPLY_CITY_FLIGHTS,          // city, then REPLY_FLIGHT_INFO records
+  REPLY_FLIGHT_INFO,           // time, available, capacity
+  REPLY_LIST_END,              // ends a list of records
+  REPLY_CITY_MAX_FLIGHTS,      // city
+  REPLY_FLIGHT_BAD_TIME,       //
+  REPLY_FLIGHT_NO_SEATS,       //
+  REPLY_FLIGHT_ALL_SEATS_EMPTY,//
+  REPLY_TIME_BAD,              //
+  REPLY_CAPACITY_BAD,          //
+  REPLY_CITY,                  // city
+  REPLY_DEPARTURES,            // from, to
+  REPLY_DEPARTURE_INFO,        // city, time, available, capacity
+  REPLY_HOUR_SEATS,            // hour, seats
+  REPLY_CITY_PREFIX,           // prefix
+  REPLY_CITY_SIMILAR,          // city, distance
+  REPLY_CITY_MATCH,            // city, distance
+  REPLY_DISTANCE_BAD,          //
+  REPLY_SEATS_BAD,             //
+  REPLY_BATCH_BAD,             //
+  REPLY_BATCH_FAILED,          // city, time, seats
+  REPLY_BATCH_BOOKED,          // city, time, seats
+  REPLY_BULK_BAD,              // file name
+  REPLY_BULK_LOADED,           // flights, cities, rows skipped
+  REPLY_SEAT_MAPS_OFF,         //
+  REPLY_SEATS_BOOKED,          // first seat, last seat
+  REPLY_SEATS_NO_BLOCK,        // seats
+  REPLY_SEAT_BAD,              // seat
+  REPLY_SEAT_MAP,              // city, time, capacity, capacity bits
+  REPLY_CLOCK,                 // time, flights departed
+  REPLY_SNAPSHOT,              // version, time
+  REPLY_SNAPSHOT_NONE,         //
 };
 
-// Structure for an individual flight schedule
-// The main data structure of the program is an Array of these structures
-// Each structure will be placed on one of two linked lists:
-//                free or active
-// Initially the active list will be empty and all the schedules
-// will be on the free list.  Adding a schedule is finding the first
-// free schedule on the free list, removing it from the free list,
-// setting its destination city and putting it on the active list
-struct flight_schedule {
-  city_t destination;                          // destination city name
-  struct flight flights[MAX_FLIGHTS_PER_CITY]; // array of flights to the city
-  struct flight_schedule *next;                // link list next pointer
-  struct flight_schedule *prev;                // link list prev pointer
+#ifdef FLIGHT_STATS
+// What the front end measures, the engine measures its own operations.
+// Times are in cycles of the cpu's cycle counter.
+struct cmd_stats {
+  struct stats_histogram command[STATS_COMMANDS];  // per command letter
+  struct stats_histogram parse;                    // reading a city
 };
+struct cmd_stats cmd_stats;
 
-/******************************************************************************
- * Global / External variables                                                *
- ******************************************************************************/
-// This program uses two global linked lists of Schedules.  See comments
-// of struct flight_schedule above for details
-struct flight_schedule *flight_schedules_free = NULL;
-struct flight_schedule *flight_schedules_active = NULL;
+void stats_command(char command, uint64_t cycles);
+#define STATS_COMMAND(c, t) stats_command((c), stats_cycles() - (t))
+#else
+#define STATS_COMMAND(c, t)
+#endif
 
 
 /******************************************************************************
  * Function Prototypes                                                        *
  ******************************************************************************/
+// Response writer functions
+void out_bytes(const char *bytes, size_t n);
+void out_str(const char *s);
+void out_char(char c);
+void out_int(long value);
+void out_uint(uint64_t value);
+void out_flush(void);
+void out_flush_stdout(void);
+void msg_command_bad(void);
+void msg_flight_status(enum flight_status status, city_id_t city);
+
 // Misc utility io functions
+int input_getc(void);
+bool input_int(int *value);
+bool input_command(char *command);
 int city_read(city_t city);           
-bool time_get(time_t *time_ptr);      
+int line_read(char *line, int max_len);
+city_id_t city_get(void);
+city_id_t city_get_new(void);
+const char *city_name(city_id_t city);
+bool time_get(flight_time_t *time_ptr);      
 bool flight_capacity_get(int *capacity_ptr);
+bool seat_count_get(int *seats_ptr);
 void print_command_help(void);
 
-// Core functions of the program
-void flight_schedule_initialize(struct flight_schedule array[], int n);
-struct flight_schedule * flight_schedule_find(city_t city);
-struct flight_schedule * flight_schedule_allocate(void);
-void flight_schedule_free(struct flight_schedule *fs);
-void flight_schedule_add(city_t city);
+// Command handlers
+void flight_schedule_add(city_id_t city);
 void flight_schedule_listAll(void);
-void flight_schedule_list(city_t city);
-void flight_schedule_add_flight(city_t city);
-void flight_schedule_remove_flight(city_t city);
-void flight_schedule_schedule_seat(city_t city);
-void flight_schedule_unschedule_seat(city_t city);
-void flight_schedule_remove(city_t city);
-
-void flight_schedule_sort_flights_by_time(struct flight_schedule *fs);
-int  flight_compare_time(const void *a, const void *b);
-
-
+void flight_schedule_list(city_id_t city);
+void flight_schedule_add_flight(city_id_t city);
+void flight_schedule_remove_flight(city_id_t city);
+void flight_schedule_schedule_seat(city_id_t city);
+void flight_schedule_unschedule_seat(city_id_t city);
+void flight_schedule_remove(city_id_t city);
+void flight_schedule_departures(void);
+void flight_schedule_seats_per_hour(void);
+void flight_schedule_prefix(city_t prefix);
+void flight_schedule_similar(city_t city);
+void flight_schedule_batch(void);
+void flight_schedule_stats(void);
+bool flight_command_execute(char command);
+void flight_response_format(void);
+void flight_schedule_bulk_load(const char *path);
+void flight_schedule_seat_block(city_id_t city);
+void flight_schedule_seat_release(city_id_t city);
+void flight_schedule_seat_release_all(city_id_t city);
+void flight_schedule_seat_map(city_id_t city);
+void flight_schedule_clock(void);
+void flight_clock_wall(void);
+void flight_schedule_snapshot(void);
+void flight_schedule_snapshot_list(city_id_t city);
+
+// Workload generator and replay benchmark
+void flight_workload_generate(uint64_t seed, long commands);
+void flight_workload_replay(const char *path);
+char *file_read(const char *path, long *size);
+
+// Server mode functions
+size_t command_frame(const char *buf, size_t len);
+void flight_server_run(const char *address);
+void flight_server_bench(const char *address, int clients, long requests);
 
 int main(int argc, char *argv[]) 
 {
   long n = MAX_DEFAULT_SCHEDULES;
   char command;
-  city_t city;
-
-  if (argc > 1) {
-    // If the program was passed an argument then try and convert the first
-    // argument in the a number that will override the default max number
-    // of schedule we will support
-    char *end;
-    n = strtol(argv[1], &end, 10); // CPAMA p 787
-    if (n==0) {
-      printf("ERROR: Bad number of default max scedules specified.\n");
-      exit(EXIT_FAILURE);
+  const char *listen_address = NULL;
+  const char *bulk_path = NULL;
+  const char *replay_path = NULL;
+  bool wall_clock = false;
+  bool seat_maps = false;
+
+  atexit(out_flush_stdout);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      // Serve the command protocol on a unix socket path or a loopback
+      // tcp port instead of stdin "-l /tmp/flights.sock" or "-l 7000"
+      listen_address = argv[++i];
+    } else if (strcmp(argv[i], "-s") == 0) {
+      // Keep a map of the taken seats of every flight
+      seat_maps = true;
+    } else if (strcmp(argv[i], "-w") == 0) {
+      // Run the clock from the wall clock, day 0 being today
+      wall_clock = true;
+    } else if (strcmp(argv[i], "-g") == 0 && i + 2 < argc) {
+      // Write a generated workload to stdout "-g <seed> <commands>"
+      flight_workload_generate(strtoull(argv[i+1], NULL, 10), atol(argv[i+2]));
+      return EXIT_SUCCESS;
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      // Time every command of a workload file and print a report
+      replay_path = argv[++i];
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      // Bulk load a csv file of flights before anything else "-c flights.csv"
+      bulk_path = argv[++i];
+    } else if (strcmp(argv[i], "-b") == 0 && i + 3 < argc) {
+      // Benchmark a running server "-b <address> <clients> <requests>"
+      flight_server_bench(argv[i+1], atoi(argv[i+2]), atol(argv[i+3]));
+      return EXIT_SUCCESS;
+    } else {
+      // If the program was passed an argument then try and convert the
+      // argument in the a number that will override the default max number
+      // of schedule we will support
+      char *end;
+      n = strtol(argv[i], &end, 10); // CPAMA p 787
+      if (n<=0) {
+        printf("ERROR: Bad number of default max scedules specified.\n");
+        exit(EXIT_FAILURE);
+      }
     }
   }
 
-  // C99 lets us allocate an array of a fixed length as a local 
-  // variable.  Since we are doing this in main and a call to main will be 
-  // active for the entire time of the program's execution this
-  // array will be alive for the entire time -- its memory and values
-  // will be stable for the entire program execution.
-  struct flight_schedule flight_schedules[n];
- 
-  // Initialize our global lists of free and active schedules using
-  // the elements of the flight_schedules array
-  flight_schedule_initialize(flight_schedules, n);
+  // All the schedules live in the engine for the entire program execution
+  engine = flight_engine_create(n, seat_maps);
+  if (engine == NULL) {
+    printf("ERROR: Unable to allocate %ld schedules.\n", n);
+    exit(EXIT_FAILURE);
+  }
+  if (wall_clock) {
+    flight_clock_wall();
+  }
+
+  if (bulk_path != NULL) {
+    flight_schedule_bulk_load(bulk_path);
+  }
+
+  if (listen_address != NULL) {
+    // the server never returns, so the bulk load report goes out now
+    out_flush();
+    flight_server_run(listen_address);
+    return EXIT_SUCCESS;
+  }
 
-  // DEFENSIVE PROGRAMMING:  Write code that avoids bad things from happening.
-  //  When possible, if we know that some particular thing should have happened
-  //  we think of that as an assertion and write code to test them.
-  // Use the assert function (CPAMA p749) to be sure the initilization has set
-  // the free list to a non-null value and the the active list is a null value.
-  assert(flight_schedules_free != NULL && flight_schedules_active == NULL);
+  if (replay_path != NULL) {
+    flight_workload_replay(replay_path);
+    return EXIT_SUCCESS;
+  }
 
   // Print the instruction in the beginning
   print_command_help();
 
-  // Command processing loop
-  while (scanf(" %c", &command) == 1) {
-    switch (command) {
-    case 'A': 
-      //  Add an active flight schedule for a new city eg "A Toronto\n"
-      city_read(city);
-      flight_schedule_add(city);
+  // Command processing loop.  When a person is typing the responses are
+  // written after every command, otherwise only when the buffer is full
+  bool interactive = isatty(STDIN_FILENO);
 
-      break;
-    case 'L':
-      // List all active flight schedules eg. "L\n"
-      flight_schedule_listAll();
-      break;
-    case 'l': 
-      // List the flights for a particular city eg. "l\n"
-      city_read(city);
-      flight_schedule_list(city);
-      break;
-    case 'a':
-      // Adds a flight for a particular city "a Toronto\n
-      //                                      360 100\n"
-      city_read(city);
-      flight_schedule_add_flight(city);
-      break;
-    case 'r':
-      // Remove a flight for a particular city "r Toronto\n
-      //                                        360\n"
-      city_read(city);
-      flight_schedule_remove_flight(city);
-	break;
-    case 's':
-      // schedule a seat on a flight for a particular city "s Toronto\n
-      //                                                    300\n"
-      city_read(city);
-      flight_schedule_schedule_seat(city);
-      break;
-    case 'u':
-      // unschedule a seat on a flight for a particular city "u Toronto\n
-      //                                                      360\n"
-        city_read(city);
-        flight_schedule_unschedule_seat(city);
-        break;
-    case 'R':
-      // remove the schedule for a particular city "R Toronto\n"
-      city_read(city);
-      flight_schedule_remove(city);  
-      break;
-    case 'h':
-        print_command_help();
-        break;
-    case 'q':
-      goto done;
-    default:
-      printf("Bad command. Use h to see help.\n");
+  while (input_command(&command) && flight_command_execute(command)) {
+    if (interactive) {
+      out_flush();
     }
   }
- done:
+  flight_snapshot_release(snapshot);
+  flight_engine_destroy(engine);
   return EXIT_SUCCESS;
 }
 
+/**********************************************************************
+ * flight_command_execute: Reads the arguments of command and runs it *
+ * Returns false when the command asks to quit.                       *
+ *********************************************************************/
+bool flight_command_execute(char command)
+{
+  city_t city;
+  STATS_START(command_start);
+
+  if (wall_clock_origin != 0) {
+    // flights that departed since the last command are retired first
+    flight_clock_advance(engine, (time(NULL) - wall_clock_origin) / 60);
+  }
+
+  switch (command) {
+  case 'A': 
+    //  Add an active flight schedule for a new city eg "A Toronto\n"
+    flight_schedule_add(city_get_new());
+
+    break;
+  case 'L':
+    // List all active flight schedules eg. "L\n"
+    flight_schedule_listAll();
+    break;
+  case 'l': 
+    // List the flights for a particular city eg. "l\n"
+    flight_schedule_list(city_get());
+    break;
+  case 'a':
+    // Adds a flight for a particular city "a Toronto\n
+    //                                      360 100\n"
+    flight_schedule_add_flight(city_get());
+    break;
+  case 'r':
+    // Remove a flight for a particular city "r Toronto\n
+    //                                        360\n"
+    flight_schedule_remove_flight(city_get());
+    break;
+  case 's':
+    // schedule a seat on a flight for a particular city "s Toronto\n
+    //                                                    300\n"
+    flight_schedule_schedule_seat(city_get());
+    break;
+  case 'u':
+    // unschedule a seat on a flight for a particular city "u Toronto\n
+    //                                                      360\n"
+      flight_schedule_unschedule_seat(city_get());
+      break;
+  case 'R':
+    // remove the schedule for a particular city "R Toronto\n"
+    flight_schedule_remove(city_get());  
+    break;
+  case 'b':
+    // Book a batch of requests, all or nothing "b 2\n
+    //                                           Toronto\n
+    //                                           300 4\n
+    //                                           Boston\n
+    //                                           600 2\n"
+    flight_schedule_batch();
+    break;
+  case 'T':
+    // List the flights of all cities departing in a time range with at
+    // least a number of available seats "T 300 720 2\n"
+    flight_schedule_departures();
+    break;
+  case 'H':
+    // Total available seats per hour across all cities "H\n"
+    flight_schedule_seats_per_hour();
+    break;
+  case 'P':
+    // List the cities whose name starts with a prefix "P Tor\n"
+    city_read(city);
+    flight_schedule_prefix(city);
+    break;
+  case 'F':
+    // List the cities within a number of edits of a name "F Torotno\n
+    //                                                      2\n"
+    city_read(city);
+    flight_schedule_similar(city);
+    break;
+  case 'Z':
+    // Print the statistics gathered so far "Z\n"
+    flight_schedule_stats();
+    break;
+  case 'B': {
+    // Bulk load flights from a csv file "B flights.csv\n"
+    char path[MAX_PATH_LEN + 1];
+    line_read(path, MAX_PATH_LEN);
+    flight_schedule_bulk_load(path);
+    break;
+  }
+  case 'k':
+    // Book a block of adjacent seats on a flight with seat maps "k Toronto\n
+    //                                                           360 3\n"
+    flight_schedule_seat_block(city_get());
+    break;
+  case 'x':
+    // Release one seat of a flight with seat maps "x Toronto\n
+    //                                              360 12\n"
+    flight_schedule_seat_release(city_get());
+    break;
+  case 'X':
+    // Release every seat of a flight with seat maps "X Toronto\n
+    //                                                360\n"
+    flight_schedule_seat_release_all(city_get());
+    break;
+  case 'm':
+    // Show the seat map of a flight "m Toronto\n
+    //                                360\n"
+    flight_schedule_seat_map(city_get());
+    break;
+  case 'C':
+    // Advance the clock retiring the flights that departed "C 1500\n"
+    flight_schedule_clock();
+    break;
+  case 'S':
+    // Take a snapshot of the schedules, replacing the last one "S\n"
+    flight_schedule_snapshot();
+    break;
+  case 'V':
+    // List the flights of a city as of the snapshot "V Toronto\n"
+    flight_schedule_snapshot_list(city_get());
+    break;
+  case 'M':
+    // Select the response format, 0 for text 1 for binary "M 1\n"
+    flight_response_format();
+    break;
+  case 'h':
+      print_command_help();
+      break;
+  case 'q':
+    return false;
+  default:
+    msg_command_bad();
+  }
+  STATS_COMMAND(command, command_start);
+  return true;
+}
+
+/**********************************************************************
+ * input_getc: Returns the next character of the command input or EOF *
+ *********************************************************************/
+int input_getc(void) {
+  if (cmd_in.buf == NULL) {
+    return getchar();
+  }
+  return (cmd_in.pos < cmd_in.len) ? (unsigned char)cmd_in.buf[cmd_in.pos++] : EOF;
+}
+
+/**********************************************************************
+ * input_int: Reads a decimal integer from the command input the way  *
+ * scanf("%d") does.  Returns false if there is no integer to read.   *
+ *********************************************************************/
+bool input_int(int *value) {
+  if (cmd_in.buf == NULL) {
+    return scanf("%d", value) == 1;
+  }
+
+  size_t p = cmd_in.pos;
+  bool negative = false;
+  long v = 0;
+
+  while (p < cmd_in.len && isspace((unsigned char)cmd_in.buf[p])) {
+    p++;
+  }
+  if (p < cmd_in.len && (cmd_in.buf[p] == '-' || cmd_in.buf[p] == '+')) {
+    negative = cmd_in.buf[p++] == '-';
+  }
+  if (p == cmd_in.len || !isdigit((unsigned char)cmd_in.buf[p])) {
+    cmd_in.pos = p;
+    return false;
+  }
+  while (p < cmd_in.len && isdigit((unsigned char)cmd_in.buf[p])) {
+    v = v * 10 + (cmd_in.buf[p++] - '0');
+  }
+  cmd_in.pos = p;
+  *value = negative ? -v : v;
+  return true;
+}
+
+/**********************************************************************
+ * input_command: Skips white space and reads a command letter.       *
+ * Returns false at the end of the input.                             *
+ *********************************************************************/
+bool input_command(char *command) {
+  if (cmd_in.buf == NULL) {
+    return scanf(" %c", command) == 1;
+  }
+
+  int ch;
+  do {
+    ch = input_getc();
+  } while (ch != EOF && isspace(ch));
+
+  if (ch == EOF) {
+    return false;
+  }
+  *command = ch;
+  return true;
+}
+
 /**********************************************************************
  * city_read: Takes in and processes a given city following a command *
  *********************************************************************/
@@ -193,14 +541,18 @@ int city_read(city_t city) {
 
   // skip leading non letter characters
   while (true) {
-    ch = getchar();
+    ch = input_getc();
+    if (ch == EOF) {
+      city[0] = '\0';
+      return 0;
+    }
     if ((ch >= 'A' && ch <= 'Z') || (ch >='a' && ch <='z')) {
       city[i++] = ch;
       break;
     }
   }
 
-  while ((ch = getchar()) != '\n') {
+  while ((ch = input_getc()) != '\n' && ch != EOF) {
     if (i < MAX_CITY_NAME_LEN) {
       city[i++] = ch;
     }
@@ -209,64 +561,536 @@ int city_read(city_t city) {
   return i;
 }
 
+/**********************************************************************
+ * line_read: Reads the rest of a line following a command, without   *
+ * leading white space and truncated to max_len characters            *
+ *********************************************************************/
+int line_read(char *line, int max_len) {
+  int ch, i=0;
+
+  do {
+    ch = input_getc();
+  } while (ch != EOF && ch != '\n' && isspace(ch));
+
+  while (ch != EOF && ch != '\n') {
+    if (i < max_len) {
+      line[i++] = ch;
+    }
+    ch = input_getc();
+  }
+  line[i] = '\0';
+  return i;
+}
+
+/**********************************************************************
+ * city_get: Reads a city following a command and returns its id, or  *
+ * CITY_ID_NULL if it was never added.  Names that are only looked up *
+ * are not interned so clients cannot grow the city table at will.    *
+ *********************************************************************/
+city_id_t city_get(void) {
+  STATS_START(start);
+
+  city_read(city_input);
+  city_id_t id = flight_city_find(engine, city_input);
+  STATS_STOP(cmd_stats.parse, start);
+  return id;
+}
+
+/**********************************************************************
+ * city_get_new: Reads a city following a command and returns its id, *
+ * giving it one if it has none.  Only adding a schedule does this.   *
+ *********************************************************************/
+city_id_t city_get_new(void) {
+  STATS_START(start);
+
+  city_read(city_input);
+  city_id_t id = flight_city_id(engine, city_input);
+  STATS_STOP(cmd_stats.parse, start);
+  return id;
+}
+
+/**********************************************************************
+ * city_name: Returns the name of city, or the name city_get read for *
+ * CITY_ID_NULL                                                       *
+ *********************************************************************/
+const char *city_name(city_id_t city) {
+  return (city == CITY_ID_NULL) ? city_input : flight_city_name(engine, city);
+}
+
 
 /****************************************************************
  * Message functions so that your messages match what we expect *
  ****************************************************************/
-void msg_city_bad(char *city) {
-  printf("No schedule for %s\n", city);
+/****************************************************************
+ * Starts a binary record with code and returns true when the   *
+ * responses are in the binary format                           *
+ ****************************************************************/
+static bool reply_binary(enum reply_code code) {
+  if (cmd_out->binary) {
+    out_char(code);
+  }
+  return cmd_out->binary;
+}
+
+/****************************************************************
+ * Writes an integer field of a binary record                   *
+ ****************************************************************/
+static void reply_int(long value) {
+  char le[4] = { value, value >> 8, value >> 16, value >> 24 };
+  out_bytes(le, sizeof(le));
+}
+
+/****************************************************************
+ * Writes a 64 bit integer field of a binary record, low half   *
+ * first                                                        *
+ ****************************************************************/
+static void reply_int64(uint64_t value) {
+  reply_int(value & 0xffffffff);
+  reply_int(value >> 32);
+}
+
+/****************************************************************
+ * Writes a city field of a binary record                       *
+ ****************************************************************/
+static void reply_city(const char *city) {
+  size_t n = strlen(city);
+  out_char(n);
+  out_bytes(city, n);
+}
+
+/****************************************************************
+ * Free text (help, statistics) is written between these two.   *
+ * In the binary format it becomes one REPLY_TEXT record whose  *
+ * length is filled in once the text is complete.  The buffer   *
+ * grows instead of being written out meanwhile so the length   *
+ * field is still there to fill in.                             *
+ ****************************************************************/
+static size_t reply_text_begin(void) {
+  if (reply_binary(REPLY_TEXT)) {
+    reply_int(0);
+    cmd_out->text_fd = cmd_out->fd;
+    cmd_out->fd = -1;
+  }
+  return cmd_out->len;
 }
 
-void msg_city_exists(char *city) {
-  printf("There is a schedule of %s already.\n", city);
+static void reply_text_end(size_t start) {
+  if (cmd_out->binary) {
+    size_t n = cmd_out->len - start;
+    char le[4] = { n, n >> 8, n >> 16, n >> 24 };
+    memcpy(cmd_out->buf + start - sizeof(le), le, sizeof(le));
+    cmd_out->fd = cmd_out->text_fd;
+    cmd_out->text_fd = -1;
+  }
+}
+
+void msg_command_bad(void) {
+  if (reply_binary(REPLY_COMMAND_BAD)) return;
+  out_str("Bad command. Use h to see help.\n");
+}
+
+void msg_city_bad(const char *city) {
+  if (reply_binary(REPLY_CITY_BAD)) {
+    reply_city(city);
+    return;
+  }
+  out_str("No schedule for ");
+  out_str(city);
+  out_char('\n');
+}
+
+void msg_city_exists(const char *city) {
+  if (reply_binary(REPLY_CITY_EXISTS)) {
+    reply_city(city);
+    return;
+  }
+  out_str("There is a schedule of ");
+  out_str(city);
+  out_str(" already.\n");
 }
 
 void msg_schedule_no_free(void) {
-  printf("Sorry no more free schedules.\n");
+  if (reply_binary(REPLY_SCHEDULE_NO_FREE)) return;
+  out_str("Sorry no more free schedules.\n");
 }
 
-void msg_city_flights(char *city) {
-  printf("The flights for %s are:", city);
+void msg_city_flights(const char *city) {
+  if (reply_binary(REPLY_CITY_FLIGHTS)) {
+    reply_city(city);
+    return;
+  }
+  out_str("The flights for ");
+  out_str(city);
+  out_str(" are:");
 }
 
 void msg_flight_info(int time, int avail, int capacity) {
-  printf(" (%d, %d, %d)", time, avail, capacity);
+  if (reply_binary(REPLY_FLIGHT_INFO)) {
+    reply_int(time);
+    reply_int(avail);
+    reply_int(capacity);
+    return;
+  }
+  out_str(" (");
+  out_int(time);
+  out_str(", ");
+  out_int(avail);
+  out_str(", ");
+  out_int(capacity);
+  out_char(')');
+}
+
+void msg_list_end(void) {
+  if (reply_binary(REPLY_LIST_END)) return;
+  out_char('\n');
+}
+
+/****************************************************************
+ * Ends a list whose text has no closing line, so binary        *
+ * clients can tell where it ends even when it is empty         *
+ ****************************************************************/
+void msg_binary_list_end(void) {
+  reply_binary(REPLY_LIST_END);
 }
 
-void msg_city_max_flights_reached(char *city) {
-  printf("Sorry we cannot add more flights on this city.\n");
+void msg_city_max_flights_reached(const char *city) {
+  if (reply_binary(REPLY_CITY_MAX_FLIGHTS)) {
+    reply_city(city);
+    return;
+  }
+  out_str("Sorry we cannot add more flights on this city.\n");
 }
 
 void msg_flight_bad_time(void) {
-  printf("Sorry there's no flight scheduled on this time.\n");
+  if (reply_binary(REPLY_FLIGHT_BAD_TIME)) return;
+  out_str("Sorry there's no flight scheduled on this time.\n");
 }
 
 void msg_flight_no_seats(void) {
-    printf("Sorry there's no more seats available!\n");
+  if (reply_binary(REPLY_FLIGHT_NO_SEATS)) return;
+  out_str("Sorry there's no more seats available!\n");
 }
 
 void msg_flight_all_seats_empty(void) {
-  printf("All the seats on this flights are empty!\n");
+  if (reply_binary(REPLY_FLIGHT_ALL_SEATS_EMPTY)) return;
+  out_str("All the seats on this flights are empty!\n");
+}
+
+void msg_city_name(const char *city) {
+  if (reply_binary(REPLY_CITY)) {
+    reply_city(city);
+    return;
+  }
+  out_str(city);
+  out_char('\n');
+}
+
+void msg_departures(int from, int to) {
+  if (reply_binary(REPLY_DEPARTURES)) {
+    reply_int(from);
+    reply_int(to);
+    return;
+  }
+  out_str("The flights departing between ");
+  out_int(from);
+  out_str(" and ");
+  out_int(to);
+  out_str(" are:\n");
+}
+
+void msg_departure_info(const char *city, int time, int avail, int capacity) {
+  if (reply_binary(REPLY_DEPARTURE_INFO)) {
+    reply_city(city);
+    reply_int(time);
+    reply_int(avail);
+    reply_int(capacity);
+    return;
+  }
+  out_str(city);
+  msg_flight_info(time, avail, capacity);
+  out_char('\n');
+}
+
+void msg_hour_seats(int hour, long seats) {
+  if (reply_binary(REPLY_HOUR_SEATS)) {
+    reply_int(hour);
+    reply_int64(seats);
+    return;
+  }
+  out_char('0' + hour / 10);
+  out_char('0' + hour % 10);
+  out_str(":00 ");
+  out_int(seats);
+  out_char('\n');
+}
+
+void msg_city_prefix(char *prefix) {
+  if (reply_binary(REPLY_CITY_PREFIX)) {
+    reply_city(prefix);
+    return;
+  }
+  out_str("The cities starting with ");
+  out_str(prefix);
+  out_str(" are:\n");
+}
+
+void msg_city_similar(char *city, int distance) {
+  if (reply_binary(REPLY_CITY_SIMILAR)) {
+    reply_city(city);
+    reply_int(distance);
+    return;
+  }
+  out_str("The cities within ");
+  out_int(distance);
+  out_str(" edits of ");
+  out_str(city);
+  out_str(" are:\n");
+}
+
+void msg_city_match(const char *city, int distance) {
+  if (reply_binary(REPLY_CITY_MATCH)) {
+    reply_city(city);
+    reply_int(distance);
+    return;
+  }
+  out_str(city);
+  out_str(" (");
+  out_int(distance);
+  out_str(")\n");
+}
+
+void msg_distance_bad(void) {
+  if (reply_binary(REPLY_DISTANCE_BAD)) return;
+  out_str("Invalid distance value\n");
+}
+
+void msg_seats_bad(void) {
+  if (reply_binary(REPLY_SEATS_BAD)) return;
+  out_str("Invalid number of seats\n");
+}
+
+void msg_batch_bad(void) {
+  if (reply_binary(REPLY_BATCH_BAD)) return;
+  out_str("Invalid batch size\n");
+}
+
+void msg_batch_failed(const char *city, int time, int seats) {
+  if (reply_binary(REPLY_BATCH_FAILED)) {
+    reply_city(city);
+    reply_int(time);
+    reply_int(seats);
+    return;
+  }
+  out_str("Sorry no flight to ");
+  out_str(city);
+  out_str(" at ");
+  out_int(time);
+  out_str(" or later has ");
+  out_int(seats);
+  out_str(" seats, no seats were booked.\n");
+}
+
+void msg_batch_booked(const char *city, int time, int seats) {
+  if (reply_binary(REPLY_BATCH_BOOKED)) {
+    reply_city(city);
+    reply_int(time);
+    reply_int(seats);
+    return;
+  }
+  out_str("Booked ");
+  out_int(seats);
+  out_str(" seats to ");
+  out_str(city);
+  out_str(" at ");
+  out_int(time);
+  out_char('\n');
+}
+
+void msg_bulk_bad(const char *path) {
+  if (reply_binary(REPLY_BULK_BAD)) {
+    reply_city(path);
+    return;
+  }
+  out_str("Unable to read ");
+  out_str(path);
+  out_char('\n');
+}
+
+void msg_bulk_loaded(long flights, long cities, long skipped) {
+  if (reply_binary(REPLY_BULK_LOADED)) {
+    reply_int(flights);
+    reply_int(cities);
+    reply_int(skipped);
+    return;
+  }
+  out_str("Loaded ");
+  out_int(flights);
+  out_str(" flights to ");
+  out_int(cities);
+  out_str(" cities, ");
+  out_int(skipped);
+  out_str(" rows skipped.\n");
+}
+
+void msg_seat_maps_off(void) {
+  if (reply_binary(REPLY_SEAT_MAPS_OFF)) return;
+  out_str("Seat maps are off, start the program with -s.\n");
+}
+
+void msg_seats_booked(int first, int last) {
+  if (reply_binary(REPLY_SEATS_BOOKED)) {
+    reply_int(first);
+    reply_int(last);
+    return;
+  }
+  out_str("Booked seats ");
+  out_int(first);
+  out_str(" to ");
+  out_int(last);
+  out_char('\n');
+}
+
+void msg_seats_no_block(int seats) {
+  if (reply_binary(REPLY_SEATS_NO_BLOCK)) {
+    reply_int(seats);
+    return;
+  }
+  out_str("Sorry there's no block of ");
+  out_int(seats);
+  out_str(" adjacent seats!\n");
+}
+
+void msg_seat_bad(int seat) {
+  if (reply_binary(REPLY_SEAT_BAD)) {
+    reply_int(seat);
+    return;
+  }
+  out_str("Seat ");
+  out_int(seat);
+  out_str(" is not taken.\n");
+}
+
+void msg_seat_map(const char *city, const struct flight *f) {
+  if (reply_binary(REPLY_SEAT_MAP)) {
+    reply_city(city);
+    reply_int(f->time);
+    reply_int(f->capacity);
+    for (int seat = 0; seat < f->capacity; seat += 8) {
+      out_char(f->seat_map[seat / SEAT_WORD_BITS] >> (seat % SEAT_WORD_BITS));
+    }
+    return;
+  }
+  out_str("The seats for ");
+  out_str(city);
+  out_str(" at ");
+  out_int(f->time);
+  out_str(" are: ");
+  for (int seat = 0; seat < f->capacity; seat++) {
+    out_char((f->seat_map[seat / SEAT_WORD_BITS] >> (seat % SEAT_WORD_BITS)) & 1 ? 'X' : '.');
+  }
+  out_char('\n');
+}
+
+void msg_clock(flight_time_t time, int departed) {
+  if (reply_binary(REPLY_CLOCK)) {
+    reply_int(time);
+    reply_int(departed);
+    return;
+  }
+  out_str("The clock is now ");
+  out_int(time);
+  out_str(", ");
+  out_int(departed);
+  out_str(" flights departed.\n");
+}
+
+void msg_snapshot(uint64_t version, flight_time_t time) {
+  if (reply_binary(REPLY_SNAPSHOT)) {
+    reply_int64(version);
+    reply_int(time);
+    return;
+  }
+  out_str("Snapshot ");
+  out_uint(version);
+  out_str(" taken at ");
+  out_int(time);
+  out_str(".\n");
+}
+
+void msg_snapshot_none(void) {
+  if (reply_binary(REPLY_SNAPSHOT_NONE)) return;
+  out_str("No snapshot taken.\n");
 }
 
 void msg_time_bad() {
-  printf("Invalid time value\n");
+  if (reply_binary(REPLY_TIME_BAD)) return;
+  out_str("Invalid time value\n");
 }
 
 void msg_capacity_bad() {
-  printf("Invalid capacity value\n");
+  if (reply_binary(REPLY_CAPACITY_BAD)) return;
+  out_str("Invalid capacity value\n");
+}
+
+/****************************************************************
+ * Prints the message of a failed engine operation on city      *
+ ****************************************************************/
+void msg_flight_status(enum flight_status status, city_id_t city) {
+  switch (status) {
+  case FLIGHT_OK:
+    break;
+  case FLIGHT_CITY_BAD:
+    msg_city_bad(city_name(city));
+    break;
+  case FLIGHT_CITY_EXISTS:
+    msg_city_exists(city_name(city));
+    break;
+  case FLIGHT_NO_FREE_SCHEDULE:
+    msg_schedule_no_free();
+    break;
+  case FLIGHT_MAX_FLIGHTS:
+    msg_city_max_flights_reached(city_name(city));
+    break;
+  case FLIGHT_TIME_BAD:
+    msg_time_bad();
+    break;
+  case FLIGHT_CAPACITY_BAD:
+    msg_capacity_bad();
+    break;
+  case FLIGHT_NO_FLIGHT:
+    msg_flight_bad_time();
+    break;
+  case FLIGHT_NO_SEATS:
+    msg_flight_no_seats();
+    break;
+  case FLIGHT_ALL_SEATS_EMPTY:
+    msg_flight_all_seats_empty();
+    break;
+  case FLIGHT_SEAT_MAPS_OFF:
+    msg_seat_maps_off();
+    break;
+  case FLIGHT_NO_BLOCK:
+  case FLIGHT_SEAT_BAD:
+    // these need the seats asked for, the handlers print them
+    msg_command_bad();
+    break;
+  }
 }
 
 void print_command_help()
 {
-  printf("Here are the possible commands:\n"
+  size_t text = reply_text_begin();
+
+  out_str("Times are minutes since day 0 began, <day> * 1440 + <minute>.\n"
+	 "Flights can depart from the clock up to the end of day 63 after it.\n"
+	 "Here are the possible commands:\n"
 	 "A <city name>     - Add an active empty flight schedule for\n"
 	 "                    <city name>\n"
 	 "L                 - List cities which have an active schedule\n"
 	 "l <city name>     - List the flights for <city name>\n"
 	 "a <city name>\n"
          "<time> <capacity> - Add a flight for <city name> @ <time> time\n"
-	 "                    with <capacity> seats\n"  
+	 "                    with <capacity> seats, at most 65536 with -s\n"
 	 "r <city name>\n"
          "<time>            - Remove a flight form <city name> whose time is\n"
 	 "                    <time>\n"
@@ -278,73 +1102,62 @@ void print_command_help()
 	 "<time>            - unschedule a seat from flight to <city name>\n"
 	 "                    at <time>\n"
 	 "R <city name>     - Remove schedule for <city name>\n"
+	 "b <n>\n"
+	 "<city name>\n"
+	 "<time> <seats>    - Book <n> requests of <seats> seats to <city name>\n"
+	 "  ...               at <time> or the next closest time.  Either all\n"
+	 "                    the requests are booked or none of them are\n"
+	 "T <t1> <t2> <k>   - List flights of all cities departing between\n"
+	 "                    <t1> and <t2> with at least <k> seats available.\n"
+	 "                    Takes time in the flights departing in range\n"
+	 "H                 - Total available seats per hour across all cities\n"
+	 "P <prefix>        - List cities whose name starts with <prefix>\n"
+	 "F <city name>\n"
+	 "<distance>        - List cities whose name is within <distance>\n"
+	 "                    edits of <city name>\n"
+	 "Z                 - print latency and list length statistics\n"
 	 "h                 - print this help message\n"
+	 "B <file>          - Bulk load flights from a csv file of lines\n"
+	 "                    <city name>,<time>,<capacity>,<available>\n"
+	 "k <city name>\n"
+	 "<time> <k>        - Book a block of <k> adjacent seats on the flight\n"
+	 "                    to <city name> at <time> (seat maps, -s)\n"
+	 "x <city name>\n"
+	 "<time> <seat>     - Release seat number <seat> (seat maps, -s)\n"
+	 "X <city name>\n"
+	 "<time>            - Release all the seats of a flight (seat maps, -s)\n"
+	 "m <city name>\n"
+	 "<time>            - Show which seats of a flight are taken (seat maps, -s)\n"
+	 "C <time>          - Advance the clock to <time>, flights departing\n"
+	 "                    before it are removed\n"
+	 "S                 - Take a snapshot of the schedules\n"
+	 "V <city name>     - List the flights for <city name> as of the\n"
+	 "                    snapshot\n"
+	 "M <format>        - Respond in text (0) or binary (1) format\n"
 	 "q                 - quit\n"
 );
+  reply_text_end(text);
 }
 
 
-/****************************************************************
- * Resets a flight schedule                                     *
- ****************************************************************/
-void flight_schedule_reset(struct flight_schedule *fs) {
-    fs->destination[0] = 0;
-    for (int i=0; i<MAX_FLIGHTS_PER_CITY; i++) {
-      fs->flights[i].time = TIME_NULL;
-      fs->flights[i].available = 0;
-      fs->flights[i].capacity = 0;
-    }
-    fs->next = NULL;
-    fs->prev = NULL;
-}
-
-/******************************************************************
-* Initializes the flight_schedule array that will hold any flight *
-* schedules created by the user. This is called in main for you.  *
- *****************************************************************/
-
-void flight_schedule_initialize(struct flight_schedule array[], int n)
-{
-  flight_schedules_active = NULL;
-  flight_schedules_free = NULL;
-
-  // takes care of empty array case
-  if (n==0) return;
-
-  // Loop through the Array connecting them
-  // as a linear doubly linked list
-  for (int i = 0; i< n-1; i++) {
-
-    flight_schedule_reset(&array[i]);
-    array[i].next = &array[i+1];
-    array[i+1].prev = &array[i];
-
-  }
-
-  // Takes care of last node.  
-  flight_schedule_reset(&array[n-1]); // reset clears all fields
-  array[n-1].next = NULL;
-  array[n-1].prev = &array[n-2];
-  flight_schedules_free = &array[0];
-
-}
-
 /***********************************************************
  * time_get: read a time from the user
-   Time in this program is a minute number 0-((24*60)-1)=1439
+   Time in this program is a minute number counted from the
+   start of day 0, day * (24*60) + minute of the day, and
+   only the times from the clock to the end of the last day
+   of the schedule are valid.
    -1 is used to indicate the NULL empty time 
    This function should read in a time value and check its 
-   validity.  If it is not valid eg. not -1 or not 0-1439
+   validity.  If it is not valid eg. not -1 or not in range
    It should print "Invalid Time" and return false.
    othewise it should return the value in the integer pointed
    to by time_ptr.
  ***********************************************************/
 bool time_get(int *time_ptr) {
 
-  if (scanf("%d", time_ptr)==1) {
+  if (input_int(time_ptr)) {
 
-    return (TIME_NULL == *time_ptr || 
-	    (*time_ptr >= TIME_MIN && *time_ptr <= TIME_MAX));
+    return (TIME_NULL == *time_ptr || flight_time_valid(engine, *time_ptr));
 
   } 
 
@@ -361,393 +1174,1590 @@ bool time_get(int *time_ptr) {
    return the value in the integer pointed to by cap_ptr.
  ***********************************************************/
 bool flight_capacity_get(int *cap_ptr) {
-  if (scanf("%d", cap_ptr)==1) {
+  if (input_int(cap_ptr)) {
     return *cap_ptr > 0;
   }
   msg_capacity_bad();
   return false;
 }
 
-void flight_schedule_sort_flights_by_time(struct flight_schedule *fs) 
-{
-  qsort(fs->flights, MAX_FLIGHTS_PER_CITY, sizeof(struct flight),
-	flight_compare_time);
-}
-
-int flight_compare_time(const void *a, const void *b) 
-{
-  const struct flight *af = a;
-  const struct flight *bf = b;
-  
-  return (af->time - bf->time);
+/***********************************************************
+ * seat_count_get: read a number of seats from the user
+   This function should read in a number of seats and check
+   its validity.  If it is not greater than 0, it should print
+   "Invalid number of seats" and return false.  Otherwise it
+   returns the value in the integer pointed to by seats_ptr.
+ ***********************************************************/
+bool seat_count_get(int *seats_ptr) {
+  if (input_int(seats_ptr) && *seats_ptr > 0) {
+    return true;
+  }
+  msg_seats_bad();
+  return false;
 }
 
+void flight_schedule_add(city_id_t city) {
 
-struct flight_schedule * flight_schedule_allocate(void) {
+  enum flight_status status = flight_city_add(engine, city); // gives the city an empty schedule
 
-  struct flight_schedule *fs = flight_schedules_free; // pointer to be used while dealing with the flight_schedule list. Pointer points to the address of the flight_schedule_free list.
-  
-  if (fs == NULL) { // test case: if free_schedules_free is NULL
+  if (status != FLIGHT_OK) { // the city has one already or there are no free schedules
 
-    return NULL;  // return NULL
+    msg_flight_status(status, city); // print "There is a schedule of %s already." or "Sorry no more free schedules."
+    return;
 
   }
-  
-  struct flight_schedule *fst = flight_schedules_free->next; // a temeporary pointer to hold the place for the next node of the flight_schedules_free.
 
-  if (flight_schedules_active == NULL) {  // if flight_schedules_active is equal to NULL
+}
 
-    fs->next = NULL; // assign free_schedules_free's next node to NULL.
-    flight_schedules_active = fs; // assigned the flight_schedule_active to the pointer fs.
 
-    }
+void flight_schedule_remove(city_id_t city) {
 
-  else  { // if flight_schedules_active is not NULL.
+  if (flight_city_remove(engine, city) != FLIGHT_OK) { // if the city has no schedule
 
-    fs->next = flight_schedules_active; // then the next node of the fs pointer is going to point to the fligh_schedules_active
-    flight_schedules_active->prev = fs; // the previous node of the active list is also going to point to the fs pointer.
-    flight_schedules_active = fs; // assigned the address of the node of the flight_schedules_active list to the the pointer.
+    msg_city_bad(city_name(city));  // print an error message
+    return;
+  }
 
-    }
+}
 
-    flight_schedules_free = fst;
 
-  if (flight_schedules_free != NULL) {  // if flight_schedules_free does not equal NULL
+void flight_schedule_listAll(void) {
 
-    flight_schedules_free->prev = NULL;  // the previous node of flight_schedules_free is going to be NULL.
+  struct flight_cities it;  // walks the cities that have a schedule
+  city_id_t city;
+
+  flight_cities_begin(engine, &it);
+  while ((city = flight_cities_next(&it)) != CITY_ID_NULL) {  // until the end of the active list.
+
+    msg_city_name(flight_city_name(engine, city));    // print the destinations of the schedules
+
+  }
+  msg_binary_list_end();
+
+}
+
+
+void flight_schedule_list(city_id_t city) {
+  int count;
+  const struct flight *f = flight_city_flights(engine, city, &count);  // the flights of the given city in time order
+
+  if (f != NULL) {   // if the city has a schedule
+
+    msg_city_flights(flight_city_name(engine, city));    // print "The flights for %s are:"
+    for (int i = 0; i < count; i++) {  // for loop iterates over all of the flights
+
+      msg_flight_info(f[i].time, f[i].available, f[i].capacity);   // prints all the information
 
     }
+    msg_list_end();
+  }
+
+  else {  // if it is NULL
 
-  return flight_schedules_active;  // return the flight_schedules_active
+    msg_city_bad(city_name(city));  // prints "No schedule for %s\n"
+    return;
 
+  }
 }
 
+void flight_schedule_add_flight(city_id_t city){
+
+  flight_time_t time;  // initalized a variable for time
+  int capacity; // initialized a variable for capacity
+
+  bool time_ok = time_get(&time); //finds the time of a given city
+  flight_capacity_get(&capacity); //finds the capacity of a given city
+
+  if (capacity <= 0 || !time_ok || time == TIME_NULL) {  // if capacity or time is invalid
 
-void flight_schedule_add(city_t city) {
+    return;  // then finish the function
+
+  }
 
-  struct flight_schedule *fs = flight_schedule_find(city); // assigns a pointer (fs) to the flight_schedule and finds the city inside the flight_schedule
+  enum flight_status status = flight_add(engine, city, time, capacity);
 
-  if (fs != NULL) { // if the pointer fs finds a city
+  if (status != FLIGHT_OK) {  // no schedule for the city or the max number of flights has been reached
 
-    msg_city_exists(city); // Already exists; error message that prints "There is a schedule of %s already.""
+    msg_flight_status(status, city);   // print an error message
     return;
 
-  }  
-  
-  struct flight_schedule *p = flight_schedule_allocate(); // checks if there are free seats available for the given city
-  if (p != NULL) {
-    strcpy(p->destination, city);  // copy the into the destination.
   }
-  
-  else {
+}
+
+
+void flight_schedule_remove_flight(city_id_t city) {
+
+  if (!flight_city_active(engine, city)) { // if the given city has no schedule
+
+    msg_city_bad(city_name(city)); // print an error message
+    return;
+
+  }
+
+  flight_time_t j = 0;
+
+  if (1 != time_get(&j)) { // if time_get equals anything other than a valid number then it returns.
 
-    msg_schedule_no_free(); // print "Sorry no more free schedules.\n"
     return;
 
   }
 
+  enum flight_status status = flight_remove(engine, city, j);
+
+  if (status != FLIGHT_OK) {
+
+    msg_flight_status(status, city);  // print an error message saying: "Sorry there's no flight scheduled on this time.\n"
+
+  }
 }
 
 
-void flight_schedule_free(struct flight_schedule *fs) {
-  
-  if (fs->prev == NULL) {  // if the previous node of fs is equal to NULL
+void flight_schedule_schedule_seat(city_id_t city) {
 
-    if (fs->next == NULL) {  // if the next node of fs is equal to NULL
+  if (!flight_city_active(engine, city)) { // if there isn't any city found
 
-      flight_schedules_active = NULL;  // then flight_schedules_active is equal to NULL
+    msg_city_bad(city_name(city)); // then print "No schedule for %s\n"
+    return;
 
-    }
+  }
 
-    else {
+  int j = 0; // intialized a int variable j
 
-      flight_schedules_active = fs->next;  // else: if next node of fs is not NULL then flight_schedules_active is equal to the next node of fs.
+  if (1 != time_get(&j)) { // if time_get equals anything other than a valid number then it returns.
 
-    }
+    return;
+
+  }
+
+  const struct flight *booked;
+  enum flight_status status = flight_book(engine, city, j, &booked);
+
+  if (status != FLIGHT_OK) {
+
+    msg_flight_status(status, city); // there weren't seats available, print "Sorry there's no more seats available!\n"
+
+  }
+  return;
+
+}
+
+void flight_schedule_unschedule_seat(city_id_t city) {
+
+  if (!flight_city_active(engine, city)) { // if there isn't any city found
+
+    msg_city_bad(city_name(city)); // then print "No schedule for %s\n"
+    return;
 
-    
   }
 
-  else {  //else: if the previous node of fs is not equal to NULL.
+  else {
 
-    if (fs->next == NULL) {  // if next node of fs is equal to NULL
+    int j = 0; // intialized a int variable j
 
-      fs->prev->next = NULL;  // then the previous node of the next node of fs is equal to NULL
+    if (1 != time_get(&j)) {  // if time_get equals anything other than a valid number then it returns. 
 
+      return;
+      
     }
 
-    else {  // if the next node of fs is not equal to NULL.
+    enum flight_status status = flight_unbook(engine, city, j);
+
+    if (status != FLIGHT_OK) {
 
-      fs->prev->next = fs->next;  // then the previous node of the next node of fs jumps to the next node of fs
-      fs->next->prev = fs->prev;  // and the next node of the previous node of fs is equal to the previous node of fs.
+      msg_flight_status(status, city); // no seat to give back or no flight at the time
 
     }
   }
+}
 
 
-  flight_schedule_reset(fs); // reset the node
-
-  if (flight_schedules_free == NULL) {  // if flight_schedules_free is equal to NULL
+/****************************************************************
+ * Lists the flights of every city departing between two times  *
+ * with at least a given number of available seats              *
+ ****************************************************************/
+void flight_schedule_departures(void) {
+  struct flight_departures it;
+  const struct flight *f;
+  city_id_t city;
+  flight_time_t from, to;
+  int seats;
+
+  if (!time_get(&from) || !time_get(&to)) {
+    return;
+  }
+  if (!input_int(&seats)) {
+    msg_capacity_bad();
+    return;
+  }
+  if (from == TIME_NULL || to == TIME_NULL || from > to) {
+    msg_time_bad();
+    return;
+  }
 
-    flight_schedules_free = fs;  // then flight_schedules_free is equal to the fs node.
+  msg_departures(from, to);
+  flight_departures_begin(engine, &it, from, to, seats);
+  while ((f = flight_departures_next(&it, &city)) != NULL) {
+    msg_departure_info(flight_city_name(engine, city), f->time, f->available, f->capacity);
+  }
+  msg_binary_list_end();
+}
 
+/****************************************************************
+ * Prints the total number of available seats on the flights of *
+ * all cities departing in each hour of the clock's day.        *
+ ****************************************************************/
+void flight_schedule_seats_per_hour(void) {
+  for (int hour = 0; hour < HOURS_PER_DAY; hour++) {
+    msg_hour_seats(hour, flight_hour_seats(engine, hour));
   }
+  msg_binary_list_end();
+}
 
-  else {  // else: if flight_schedules_free is not equal to NULL.
-    
-    flight_schedules_free->prev = fs; // the previous node of flight_schedules_free is equal to fs
-    fs->next = flight_schedules_free;  // next node of fs is equal to flight_schedules_free
-    flight_schedules_free = fs;  // flight_schedules_free is equal to fs
+/****************************************************************
+ * Reads a time and moves the clock forward to it, removing the *
+ * flights that departed before it                              *
+ ****************************************************************/
+void flight_schedule_clock(void) {
+  flight_time_t to;
 
+  // any time after the clock is fine, not just the ones on the wheel
+  if (!input_int(&to) || to < flight_clock(engine)) {
+    msg_time_bad();
+    return;
   }
-  
+  msg_clock(to, flight_clock_advance(engine, to));
 }
 
+/****************************************************************
+ * Makes the clock follow the wall clock.  Day 0 is the day the *
+ * program started and the clock is moved before each command. *
+ ****************************************************************/
+void flight_clock_wall(void) {
+  time_t now = time(NULL);
+  struct tm midnight;
+
+  localtime_r(&now, &midnight);
+  midnight.tm_hour = 0;
+  midnight.tm_min = 0;
+  midnight.tm_sec = 0;
+  wall_clock_origin = mktime(&midnight);
+  flight_clock_advance(engine, (now - wall_clock_origin) / 60);
+}
 
-void flight_schedule_remove(city_t city) {
-  struct flight_schedule *fs = flight_schedule_find(city);  // intializes a pointer to found schedule of given city's flight
+/****************************************************************
+ * Takes a snapshot of the schedules for V, dropping the last   *
+ * one.  It takes the same time however many schedules there   *
+ * are and costs memory only for what changes after it.         *
+ ****************************************************************/
+void flight_schedule_snapshot(void) {
+  flight_snapshot_release(snapshot);
+  snapshot = flight_snapshot_take(engine);
+  msg_snapshot(flight_snapshot_version(snapshot), flight_snapshot_clock(snapshot));
+}
 
-  if (fs == NULL) { // if fs is equal to NULL
+/****************************************************************
+ * Lists the flights of city as they were when the snapshot was *
+ * taken                                                        *
+ ****************************************************************/
+void flight_schedule_snapshot_list(city_id_t city) {
+  int count;
+  const struct flight *f;
 
-    msg_city_bad(city);  // print an error message
+  if (snapshot == NULL) {
+    msg_snapshot_none();
     return;
   }
 
-  flight_schedule_free(fs);  // used flight_schedule_free to remove a flight_schedule
+  f = flight_snapshot_flights(snapshot, city, &count);
+  if (f == NULL) {
+    msg_city_bad(city_name(city));
+    return;
+  }
 
+  msg_city_flights(flight_city_name(engine, city));
+  for (int i = 0; i < count; i++) {
+    msg_flight_info(f[i].time, f[i].available, f[i].capacity);
+  }
+  msg_list_end();
 }
 
+/****************************************************************
+ * Prints the name of a city found by a name search             *
+ ****************************************************************/
+static void city_visit_name(void *arg, city_id_t city, int distance)
+{
+  (void)arg;
+  (void)distance;
+  msg_city_name(flight_city_name(engine, city));
+}
 
-struct flight_schedule * flight_schedule_find(city_t city) {
-
-  struct flight_schedule *fs = flight_schedules_active; // assigned a pointer to thee flight_schedule; the pointer equals to flight_schedule_active
+static void city_visit_match(void *arg, city_id_t city, int distance)
+{
+  (void)arg;
+  msg_city_match(flight_city_name(engine, city), distance);
+}
 
-  if (fs == NULL) {  // if the pointer is NULL
+/****************************************************************
+ * Lists the active cities whose name starts with prefix in     *
+ * alphabetical order                                           *
+ ****************************************************************/
+void flight_schedule_prefix(city_t prefix)
+{
+  msg_city_prefix(prefix);
+  flight_cities_prefix(engine, prefix, city_visit_name, NULL);
+  msg_binary_list_end();
+}
 
-    return NULL;     // then return NULL
+/****************************************************************
+ * Lists the active cities whose name is within a number of     *
+ * edits (insertions, deletions or substitutions) of city       *
+ ****************************************************************/
+void flight_schedule_similar(city_t city)
+{
+  int max_distance;
 
+  if (!input_int(&max_distance) || max_distance < 0) {
+    msg_distance_bad();
+    return;
   }
 
-  while (fs != NULL) {  // while the pointer is not NULL
+  msg_city_similar(city, max_distance);
+  flight_cities_similar(engine, city, max_distance, city_visit_match, NULL);
+  msg_binary_list_end();
+}
+
+/****************************************************************
+ * Reads a batch of booking requests and books them all or none *
+ * of them, printing the flight each request was booked on.     *
+ ****************************************************************/
+void flight_schedule_batch(void)
+{
+  int n;
 
-    if (strcmp(city, fs->destination) == 0){  // compare two strings: city and destination of the pointer and if they're not correct
+  if (!input_int(&n) || n <= 0) {
+    msg_batch_bad();
+    return;
+  }
 
-      return fs;   // return fs
+  struct booking_request *reqs = malloc(sizeof(struct booking_request) * n);
+  city_t *names = malloc(sizeof(city_t) * n);  // cities may have no id
+  if (reqs == NULL || names == NULL) {
+    free(reqs);
+    free(names);
+    msg_batch_bad();
+    return;
+  }
 
+  // read the whole batch before touching any schedule
+  for (int r = 0; r < n; r++) {
+    reqs[r].city = city_get();
+    strcpy(names[r], city_input);
+    if (!time_get(&reqs[r].time) || reqs[r].time == TIME_NULL ||
+        !seat_count_get(&reqs[r].seats)) {
+      free(reqs);
+      free(names);
+      return;
     }
-
-    fs = fs->next;  // check the next node of fs
-    
   }
 
-  return NULL; // return NULL if nothing is true
+  int failed = flight_book_batch(engine, reqs, n);
+  if (failed >= 0) {
+    const char *city = names[failed];
 
+    if (!flight_city_active(engine, reqs[failed].city)) {
+      msg_city_bad(city);
+    }
+    msg_batch_failed(city, reqs[failed].time, reqs[failed].seats);
+  } else {
+    for (int r = 0; r < n; r++) {
+      msg_batch_booked(flight_city_name(engine, reqs[r].city), reqs[r].booked, reqs[r].seats);
+    }
+  }
+  free(reqs);
+  free(names);
 }
 
 
-void flight_schedule_listAll(void) {
+#ifdef FLIGHT_STATS
+/****************************************************************
+ * Records how long one command took in the histogram of its    *
+ * letter.  Letters that are not timed are ignored.             *
+ ****************************************************************/
+void stats_command(char command, uint64_t cycles)
+{
+  const char *c = strchr(STATS_COMMAND_LETTERS, command);
 
-  struct flight_schedule *temp;  // pointer to the flight_schedule
-  temp = flight_schedules_active;    // points to the address of the first node of flight_schedule_active
+  if (command != '\0' && c != NULL) {
+    stats_record(&cmd_stats.command[c - STATS_COMMAND_LETTERS], cycles);
+  }
+}
+
+/****************************************************************
+ * Prints one line summarizing histogram h                      *
+ ****************************************************************/
+static void stats_print(const char *name, const struct stats_histogram *h)
+{
+  if (h->count == 0) {
+    return;
+  }
+  out_str(name);
+  for (size_t pad = strlen(name); pad < 12; pad++) {
+    out_char(' ');
+  }
+  out_str(" count ");
+  out_int(h->count);
+  out_str(" mean ");
+  out_int(h->sum / h->count);
+  out_str(" p50 ");
+  out_int(stats_percentile(h, 0.50));
+  out_str(" p99 ");
+  out_int(stats_percentile(h, 0.99));
+  out_str(" p999 ");
+  out_int(stats_percentile(h, 0.999));
+  out_str(" max ");
+  out_int(h->max);
+  out_char('\n');
+}
+#endif
 
-  while(temp != NULL) {       // while the pointer is not NULL meaning at the end of the list.
+/****************************************************************
+ * Prints the latency histograms of every command and internal  *
+ * operation in cycles, the lengths of the list walks and the   *
+ * depth of the free list.                                      *
+ ****************************************************************/
+void flight_schedule_stats(void)
+{
+  size_t text = reply_text_begin();
 
-    printf("%s\n", temp->destination);    // print the destinations of the flight_schedule
-    temp = temp->next;       // point to the next node of the flight_schedule list.
+#ifdef FLIGHT_STATS
+  static const char *op_names[STATS_OPS] = { "find", "sort" };
+  static const char *walk_names[STATS_WALKS] = { "walk active", "walk depart" };
+  const struct flight_stats *engine_stats = flight_engine_stats(engine);
+  char name[] = "command ?";
 
+  for (size_t c = 0; c < STATS_COMMANDS; c++) {
+    name[sizeof(name) - 2] = STATS_COMMAND_LETTERS[c];
+    stats_print(name, &cmd_stats.command[c]);
+  }
+  stats_print("parse", &cmd_stats.parse);
+  for (int op = 0; op < STATS_OPS; op++) {
+    stats_print(op_names[op], &engine_stats->op[op]);
   }
+  for (int w = 0; w < STATS_WALKS; w++) {
+    stats_print(walk_names[w], &engine_stats->walk[w]);
+  }
+  out_str("free list    depth ");
+  out_int(engine_stats->free_depth);
+  out_str(" min ");
+  out_int(engine_stats->free_depth_min);
+  out_char('\n');
+#else
+  out_str("Statistics are not compiled in, rebuild with -DFLIGHT_STATS\n");
+#endif
+  reply_text_end(text);
+}
 
+/****************************************************************
+ * Returns the arguments a command reads after its letter as a  *
+ * string of tokens: C for a city name line, L for a line, I    *
+ * for an integer and N for a count followed by that many "CII" *
+ * requests.                                                    *
+ ****************************************************************/
+static const char *command_grammar(char command)
+{
+  switch (command) {
+  case 'A': case 'l': case 'R': case 'P': case 'V':
+    return "C";
+  case 'a':
+    return "CII";
+  case 'r': case 's': case 'u': case 'F':
+    return "CI";
+  case 'T':
+    return "III";
+  case 'C': case 'M':
+    return "I";
+  case 'k': case 'x':
+    return "CII";
+  case 'X': case 'm':
+    return "CI";
+  case 'B':
+    return "L";
+  case 'b':
+    return "N";
+  default:
+    return "";
+  }
 }
 
+/****************************************************************
+ * Checks that the token kind ('C', 'L' or 'I') at *p has       *
+ * arrived in full and moves *p past it.  Returns 1 when it is  *
+ * complete, 0 when the command would stop reading here because *
+ * there is no integer, and -1 when more input is needed.       *
+ ****************************************************************/
+static int frame_token(char kind, const char **p, const char *end, int *value)
+{
+  const char *q = *p;
+
+  if (kind == 'C' || kind == 'L') {
+    // city_read skips to the first letter then reads up to the newline,
+    // line_read reads up to the newline
+    while (kind == 'C' && q < end && !isalpha((unsigned char)*q)) {
+      q++;
+    }
+    q = (q < end) ? memchr(q, '\n', end - q) : NULL;
+    if (q == NULL) {
+      return -1;
+    }
+    *p = q + 1;
+    return 1;
+  }
+
+  while (q < end && isspace((unsigned char)*q)) {
+    q++;
+  }
+  bool negative = (q < end && *q == '-');
+  if (q < end && (*q == '-' || *q == '+')) {
+    q++;
+  }
+  if (q == end) {
+    return -1;
+  }
+  if (!isdigit((unsigned char)*q)) {
+    return 0;
+  }
+  long v = 0;
+  while (q < end && isdigit((unsigned char)*q)) {
+    v = v * 10 + (*q++ - '0');
+  }
+  if (q == end) {
+    return -1;  // more digits may still be on their way
+  }
+  *value = negative ? -v : v;
+  *p = q;
+  return 1;
+}
 
-void flight_schedule_list(city_t city) {
-  struct flight_schedule *fs = flight_schedule_find(city);  // initialized a pointer; assigned the pointer to find the given city
+/****************************************************************
+ * Returns how many bytes of buf are enough to execute the next *
+ * command in full or 0 if it has not completely arrived yet.   *
+ * A command may consume less than this, for example when its   *
+ * city has no schedule, exactly as it would reading stdin.     *
+ ****************************************************************/
+size_t command_frame(const char *buf, size_t len)
+{
+  const char *p = buf;
+  const char *end = buf + len;
+  int value;
 
-  if (fs != NULL) {   // if fs is found meaning it's not NULL
+  while (p < end && isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (p == end) {
+    return 0;
+  }
 
-    msg_city_flights(city);    // print "The flights for %s are:"
-    for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop iterates over all of the flights
+  for (const char *g = command_grammar(*p++); *g != '\0'; g++) {
+    int r = frame_token(*g == 'N' ? 'I' : *g, &p, end, &value);
 
-      if (fs->flights[i].time != TIME_NULL) {  // checks to see if it's a valid time. 
+    if (r < 0) {
+      return 0;
+    }
+    if (r == 0) {
+      break;
+    }
+    for (int i = 0; *g == 'N' && i < value; i++) {
+      for (const char *t = "CII"; *t != '\0'; t++) {
+        int v;
 
-        time_t time = fs->flights[i].time;   // if it is assigns the time of the flight
-        int availability = fs->flights[i].available;   // assigns the availability of the flight
-        int capacity = fs->flights[i].capacity;  // assigns the capacity of the flight
-        msg_flight_info(time, availability, capacity);   // prints all the information
-        
+        r = frame_token(*t, &p, end, &v);
+        if (r < 0) {
+          return 0;
+        }
+        if (r == 0) {
+          return p - buf;
+        }
       }
     }
-    printf("\n");
   }
+  return p - buf;
+}
 
-  else {  // if it is NULL
+#ifdef __linux__
+// A connection of server mode.  Bytes are read into in until a whole
+// command has arrived, the responses of every command executed from one
+// read are gathered in out and sent with a single write.
+struct server_client {
+  int fd;
+  char *in;         // bytes received and not yet executed
+  size_t in_len;
+  size_t in_cap;
+  struct out_buffer out;  // responses not yet sent
+  size_t out_sent;        // bytes of out already sent
+  bool closing;     // q was received or the client hung up
+};
 
-    msg_city_bad(city);  // prints "No schedule for %s\n"
-    return;
+/****************************************************************
+ * Makes fd non blocking                                        *
+ ****************************************************************/
+static void server_nonblocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+/****************************************************************
+ * Opens a socket on address: a loopback tcp port if address is *
+ * a number, a unix socket path otherwise.  If connect is true  *
+ * the socket is connected to address, otherwise it listens on  *
+ * it.  Returns -1 on failure.                                  *
+ ****************************************************************/
+static int server_socket(const char *address, bool connect_to)
+{
+  char *end;
+  long port = strtol(address, &end, 10);
+  int fd;
+  int r;
+
+  if (*address != '\0' && *end == '\0') {
+    struct sockaddr_in in;
+    int one = 1;
+
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_port = htons(port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    r = connect_to ? connect(fd, (struct sockaddr *)&in, sizeof(in))
+                   : bind(fd, (struct sockaddr *)&in, sizeof(in));
+  } else {
+    struct sockaddr_un un;
+
+    if (strlen(address) >= sizeof(un.sun_path)) {
+      return -1;
+    }
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, address);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+      return -1;
+    }
+    if (!connect_to) {
+      unlink(address);
+    }
+    r = connect_to ? connect(fd, (struct sockaddr *)&un, sizeof(un))
+                   : bind(fd, (struct sockaddr *)&un, sizeof(un));
+  }
 
+  if (r < 0 || (!connect_to && listen(fd, SOMAXCONN) < 0)) {
+    close(fd);
+    return -1;
   }
+  return fd;
 }
 
+/****************************************************************
+ * Returns whether client c has SERVER_OUT_HIGH bytes of output *
+ * not sent yet, so no more of its commands are executed until  *
+ * the socket takes them.                                       *
+ ****************************************************************/
+static bool server_client_held(const struct server_client *c)
+{
+  return c->out.len - c->out_sent >= SERVER_OUT_HIGH;
+}
 
-void flight_schedule_add_flight(city_t city){
+/****************************************************************
+ * Executes every command that has fully arrived from client c  *
+ * and appends their responses to its output                    *
+ ****************************************************************/
+static void server_client_execute(struct server_client *c)
+{
+  size_t pos = 0;
+  char command;
 
-  struct flight_schedule *point;     // a pointer (named point) has been initialized.
-  point = flight_schedule_find(city); // pointer points to the address of the flight_schedule struct.
-  int i = 0; // intialized variable to find the flights of a given city.
-  time_t time;  // initalized a variable for time
-  int capacity; // initialized a variable for capacity
+  cmd_out = &c->out;
 
-  time_get(&time); //finds the time of a given city
-  flight_capacity_get(&capacity); //finds the capacity of a given city
+  while (!c->closing && !server_client_held(c)
+         && command_frame(c->in + pos, c->in_len - pos) > 0) {
+    cmd_in.buf = c->in + pos;
+    cmd_in.len = c->in_len - pos;
+    cmd_in.pos = 0;
+    if (!input_command(&command) || !flight_command_execute(command)) {
+      c->closing = true;
+    }
+    pos += cmd_in.pos;
+  }
+  cmd_in.buf = NULL;
+  cmd_out = &stdout_buffer;
 
-  if (capacity <= 0) {  // if capacity is less than or equal to zero
+  memmove(c->in, c->in + pos, c->in_len - pos);
+  c->in_len -= pos;
+}
 
-    return;  // then finish the function
+/****************************************************************
+ * Sends as much of client c's output as the socket takes.      *
+ * Returns false if the connection failed.                      *
+ ****************************************************************/
+static bool server_client_flush(struct server_client *c)
+{
+  while (c->out_sent < c->out.len) {
+    ssize_t n = send(c->fd, c->out.buf + c->out_sent, c->out.len - c->out_sent, MSG_NOSIGNAL);
 
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    c->out_sent += n;
   }
+  // everything went out, the buffer is reused for the next batch
+  c->out.len = 0;
+  c->out_sent = 0;
+  return true;
+}
 
-  else if (point->flights[i].time != -1) {  // if time is invalid = -1.
+/****************************************************************
+ * Closes the connection of client c                            *
+ ****************************************************************/
+static void server_client_close(struct server_client *c)
+{
+  close(c->fd);
+  free(c->in);
+  free(c->out.buf);
+  free(c);
+}
 
-    msg_city_max_flights_reached(city);   // then the number of max flights has been reached; print an error message
-    return;
+/****************************************************************
+ * Executes the complete commands client c has sent and sends   *
+ * back their responses, as long as its output keeps going out. *
+ * A command still incomplete after SERVER_MAX_COMMAND bytes is *
+ * answered as a bad command and the connection is dropped, so  *
+ * a client cannot make the server hold any amount of input.    *
+ * Returns false if the connection failed.                      *
+ ****************************************************************/
+static bool server_client_run(struct server_client *c)
+{
+  do {
+    // only the incomplete or held back commands are left after this
+    server_client_execute(c);
+    if (!server_client_held(c) && c->in_len > SERVER_MAX_COMMAND) {
+      cmd_out = &c->out;
+      msg_command_bad();
+      cmd_out = &stdout_buffer;
+      c->closing = true;
+    }
+    if (!server_client_flush(c)) {
+      return false;
+    }
+  } while (!c->closing && !server_client_held(c) && command_frame(c->in, c->in_len) > 0);
+  return true;
+}
 
+/****************************************************************
+ * Reads what client c has sent and executes it.  While         *
+ * SERVER_OUT_HIGH bytes of responses wait for the client, its  *
+ * input is neither read nor executed, and a client that lets   *
+ * SERVER_OUT_MAX bytes pile up is dropped, so a client that    *
+ * never reads cannot make the server hold any amount of        *
+ * output.  Returns false once the connection is finished.      *
+ ****************************************************************/
+static bool server_client_ready(int epoll_fd, struct server_client *c, uint32_t events)
+{
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    while (!c->closing && !server_client_held(c)) {
+      if (c->in_cap - c->in_len < SERVER_READ_SIZE) {
+        char *in = realloc(c->in, c->in_cap + SERVER_READ_SIZE);
+        if (in == NULL) {
+          return false;
+        }
+        c->in = in;
+        c->in_cap += SERVER_READ_SIZE;
+      }
+      ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len, 0);
+      if (n > 0) {
+        c->in_len += n;
+        if (!server_client_run(c)) {
+          return false;
+        }
+        continue;
+      }
+      if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        c->closing = true;
+      }
+      break;
+    }
   }
 
-  else if (point == NULL) {  // if the pointer is NULL
+  // commands held back while the output was waiting go now
+  if (!server_client_run(c)) {
+    return false;
+  }
+  if (c->out.len - c->out_sent > SERVER_OUT_MAX) {
+    return false;
+  }
+  if (c->out.len > 0) {
+    // wait until the socket can take the rest of the output, and
+    // only read more once it is under SERVER_OUT_HIGH
+    uint32_t wanted = server_client_held(c) ? EPOLLOUT : EPOLLIN | EPOLLOUT;
+    struct epoll_event ev = { .events = wanted, .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+    return true;
+  }
+  if (events & EPOLLOUT) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+  }
+  return !c->closing;
+}
 
-    msg_city_bad(city); // then the city couldn't be found; print an error message
-    return;
+/****************************************************************
+ * Serves the command protocol on address to any number of      *
+ * clients from a single epoll event loop.  All the clients     *
+ * share the schedules of this process.  Every command a client *
+ * pipelines in one write is executed before its responses are  *
+ * sent back together.                                          *
+ ****************************************************************/
+void flight_server_run(const char *address)
+{
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  int listen_fd = server_socket(address, false);
+  int epoll_fd = epoll_create1(0);
 
+  if (listen_fd < 0 || epoll_fd < 0) {
+    printf("ERROR: Unable to listen on %s.\n", address);
+    exit(EXIT_FAILURE);
   }
+  server_nonblocking(listen_fd);
 
-  else {
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  printf("Listening on %s\n", address);
+  fflush(stdout);
 
-    point->flights[i].time = time;     // add a time for the given city
-    point->flights[i].capacity = capacity;  // add a capacity for given city
-    point->flights[i].available = capacity; // arrange the availability of a given city's flight
-    flight_schedule_sort_flights_by_time(point); // sorts the flights by given times of a certain city.
+  while (true) {
+    int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+
+    for (int i = 0; i < n; i++) {
+      struct server_client *c = events[i].data.ptr;
 
+      if (c != NULL) {
+        if (!server_client_ready(epoll_fd, c, events[i].events)) {
+          server_client_close(c);
+        }
+        continue;
+      }
+
+      // new connections on the listening socket
+      int fd;
+      while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+        c = calloc(1, sizeof(struct server_client));
+        if (c == NULL) {
+          close(fd);
+          continue;
+        }
+        c->fd = fd;
+        c->out.fd = -1;
+        server_nonblocking(fd);
+        struct epoll_event cev = { .events = EPOLLIN, .data.ptr = c };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &cev);
+      }
+    }
   }
 }
 
+/****************************************************************
+ * Load generator for server mode.  Opens clients connections   *
+ * to address and keeps SERVER_BENCH_DEPTH list requests in     *
+ * flight on each of them until requests responses have come    *
+ * back, then prints the throughput.  A list request always has *
+ * a one line response so responses are counted by newlines.    *
+ ****************************************************************/
+void flight_server_bench(const char *address, int clients, long requests)
+{
+  static const char request[] = "l Bench\n";
+  char window[SERVER_BENCH_DEPTH * (sizeof(request) - 1)];
+  char buf[SERVER_READ_SIZE];
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  long *pending = calloc(clients, sizeof(long));
+  long sent = 0;
+  long received = 0;
+  struct timespec start, stop;
+  int epoll_fd = epoll_create1(0);
+
+  if (clients <= 0 || requests <= 0 || pending == NULL || epoll_fd < 0) {
+    printf("ERROR: Bad benchmark parameters.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < SERVER_BENCH_DEPTH; i++) {
+    memcpy(window + i * (sizeof(request) - 1), request, sizeof(request) - 1);
+  }
 
-void flight_schedule_remove_flight(city_t city) {
-  struct flight_schedule *point = flight_schedule_find(city);    // a pointer (named point) has been initialized.
-  
-  if (point == NULL) { // if the given pointer (finds the given city) is equal to NULL
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < clients; i++) {
+    int fd = server_socket(address, true);
+    if (fd < 0) {
+      printf("ERROR: Unable to connect to %s.\n", address);
+      exit(EXIT_FAILURE);
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = ((uint64_t)i << 32) | fd };
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+    long depth = (requests - sent < SERVER_BENCH_DEPTH) ? requests - sent : SERVER_BENCH_DEPTH;
+    if (depth > 0 && send(fd, window, depth * (sizeof(request) - 1), MSG_NOSIGNAL) > 0) {
+      pending[i] = depth;
+      sent += depth;
+    }
+  }
 
-    msg_city_bad(city); // print an error message
-    return;
+  while (received < requests) {
+    int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+
+    for (int e = 0; e < n; e++) {
+      int i = events[e].data.u64 >> 32;
+      int fd = (int)(events[e].data.u64 & 0xffffffff);
+      ssize_t got = recv(fd, buf, sizeof(buf), 0);
 
+      if (got <= 0) {
+        printf("ERROR: Server closed the connection.\n");
+        exit(EXIT_FAILURE);
+      }
+      for (ssize_t k = 0; k < got; k++) {
+        if (buf[k] == '\n') {
+          pending[i]--;
+          received++;
+        }
+      }
+      if (pending[i] == 0 && sent < requests) {
+        long depth = (requests - sent < SERVER_BENCH_DEPTH) ? requests - sent : SERVER_BENCH_DEPTH;
+        if (send(fd, window, depth * (sizeof(request) - 1), MSG_NOSIGNAL) > 0) {
+          pending[i] = depth;
+          sent += depth;
+        }
+      }
+    }
   }
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%ld requests from %d clients in %.3f s: %.0f ops/sec\n",
+         received, clients, seconds, received / seconds);
+  free(pending);
+}
+#else
+void flight_server_run(const char *address)
+{
+  printf("ERROR: Server mode needs epoll, cannot listen on %s.\n", address);
+  exit(EXIT_FAILURE);
+}
 
-  time_t j = 0;
+void flight_server_bench(const char *address, int clients, long requests)
+{
+  printf("ERROR: Server mode needs epoll, cannot benchmark %s.\n", address);
+  exit(EXIT_FAILURE);
+}
+#endif
 
-  if (1 != time_get(&j)) { // if time_get equals anything other than a valid number then it returns.
 
+/****************************************************************
+ * Makes room for n more bytes in the response buffer, writing  *
+ * out what it holds first if it has a descriptor               *
+ ****************************************************************/
+static void out_reserve(size_t n)
+{
+  struct out_buffer *o = cmd_out;
+
+  if (o->cap - o->len >= n) {
     return;
+  }
+  if (o->fd >= 0) {
+    out_flush();
+    if (o->cap - o->len >= n) {
+      return;
+    }
+  }
 
+  size_t cap = (o->cap == 0) ? OUT_BUFFER_SIZE : o->cap;
+  while (cap - o->len < n) {
+    cap *= 2;
+  }
+  char *buf = realloc(o->buf, cap);
+  if (buf == NULL) {
+    printf("ERROR: Unable to grow the response buffer.\n");
+    exit(EXIT_FAILURE);
   }
+  o->buf = buf;
+  o->cap = cap;
+}
 
-  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY
+/****************************************************************
+ * Appends n bytes to the response buffer                       *
+ ****************************************************************/
+void out_bytes(const char *bytes, size_t n)
+{
+  out_reserve(n);
+  memcpy(cmd_out->buf + cmd_out->len, bytes, n);
+  cmd_out->len += n;
+}
 
-    if (point->flights[i].time == j) {  // if the time for the given city is equal to the time.
+/****************************************************************
+ * Appends a string to the response buffer                      *
+ ****************************************************************/
+void out_str(const char *s)
+{
+  out_bytes(s, strlen(s));
+}
 
-      point->flights[i].time = TIME_NULL;     // add a time for the given city
-      point->flights[i].capacity = 0;  // add a capacity for given city
-      point->flights[i].available = 0; // arrange the availability of a given city's flight
-      flight_schedule_sort_flights_by_time(point); // sorts the flights by given times of a certain city.
-      return;
+/****************************************************************
+ * Appends a character to the response buffer                   *
+ ****************************************************************/
+void out_char(char c)
+{
+  out_reserve(1);
+  cmd_out->buf[cmd_out->len++] = c;
+}
 
-    }
+/****************************************************************
+ * Appends the decimal digits of value to the response buffer   *
+ ****************************************************************/
+void out_int(long value)
+{
+  if (value < 0) {
+    out_char('-');
+    out_uint(-(uint64_t)value);
+  } else {
+    out_uint(value);
   }
-
-  msg_flight_bad_time();  // print an error message saying: "Sorry there's no flight scheduled on this time.\n"
-
 }
 
+/****************************************************************
+ * Appends the decimal digits of an unsigned 64 bit value       *
+ ****************************************************************/
+void out_uint(uint64_t value)
+{
+  char digits[24];
+  int n = 0;
 
-void flight_schedule_schedule_seat(city_t city) {
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
 
-  struct flight_schedule *seat = flight_schedule_find(city); // initalized a pointer called seat
+  out_reserve(n);
+  while (n > 0) {
+    cmd_out->buf[cmd_out->len++] = digits[--n];
+  }
+}
 
-  if (seat == NULL) { // if there isn't any city found
+/****************************************************************
+ * Writes the response buffer to its descriptor                 *
+ ****************************************************************/
+void out_flush(void)
+{
+  struct out_buffer *o = cmd_out;
+  size_t done = 0;
 
-    msg_city_bad(city); // then print "No schedule for %s\n"
+  if (o->fd < 0) {
     return;
+  }
+  while (done < o->len) {
+    ssize_t n = write(o->fd, o->buf + done, o->len - done);
 
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
   }
+  o->len = 0;
+}
 
-  int j = 0; // intialized a int variable j
+/****************************************************************
+ * Writes whatever responses are left when the program exits    *
+ ****************************************************************/
+void out_flush_stdout(void)
+{
+  cmd_out = &stdout_buffer;
+  out_flush();
+}
 
-  if (1 != time_get(&j)) { // if time_get equals anything other than a valid number then it returns.
+/****************************************************************
+ * Reads the response format of the current output, 0 for text  *
+ * and 1 for the binary records described at reply_code         *
+ ****************************************************************/
+void flight_response_format(void)
+{
+  int format;
 
+  if (!input_int(&format) || format < 0 || format > 1) {
+    msg_command_bad();
     return;
+  }
+  cmd_out->binary = (format == 1);
+}
+
+
+/****************************************************************
+ * Reads the whole of file path into memory and sets *size to   *
+ * its length.  The buffer has room for a terminating byte.     *
+ * Returns NULL if the file cannot be read.                     *
+ ****************************************************************/
+char *file_read(const char *path, long *size)
+{
+  FILE *f = fopen(path, "rb");
+  char *data = NULL;
+
+  *size = -1;
+  if (f != NULL && fseek(f, 0, SEEK_END) == 0 && (*size = ftell(f)) >= 0) {
+    rewind(f);
+    data = malloc(*size + 1);
+    if (data != NULL && fread(data, 1, *size, f) != (size_t)*size) {
+      free(data);
+      data = NULL;
+    }
+  }
+  if (f != NULL) {
+    fclose(f);
+  }
+  return data;
+}
+
+/****************************************************************
+ * Loads every flight of a csv file of city,time,capacity,      *
+ * available lines.  Rows follow the rules of the a command: a  *
+ * city gets a schedule if it has none and rows past            *
+ * MAX_FLIGHTS_PER_CITY flights are skipped.                    *
+ ****************************************************************/
+void flight_schedule_bulk_load(const char *path)
+{
+  long size;
+  char *data = file_read(path, &size);
+  struct flight_bulk_result loaded;
 
+  if (data == NULL) {
+    msg_bulk_bad(path);
+    return;
   }
-  
-  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY 
 
-    int timeClose = (j - seat->flights[i].time);  // initialized timeClose variable to understand which time is the closest.
+  flight_bulk_load(engine, data, size, &loaded);
+  msg_bulk_loaded(loaded.flights, loaded.cities, loaded.skipped);
+  free(data);
+}
 
-    if (timeClose <= 0) {  // if the variable was less than or equal to zero
 
-      if (seat->flights[i].available > 0) { // and if there are available seats in the flight
+/****************************************************************
+ * Books a block of adjacent seats on a flight and prints their *
+ * seat numbers, which start at 1                               *
+ ****************************************************************/
+void flight_schedule_seat_block(city_id_t city)
+{
+  flight_time_t time;
+  int seats;
+  int first;
 
-        seat->flights[i].available--;  // decrement available seats at the flight
-        return;
+  if (!time_get(&time) || !seat_count_get(&seats)) {
+    return;
+  }
 
-      }
-    }
+  enum flight_status status = flight_seats_book_block(engine, city, time, seats, &first);
+  if (status == FLIGHT_NO_BLOCK) {
+    msg_seats_no_block(seats);
+    return;
+  }
+  if (status != FLIGHT_OK) {
+    msg_flight_status(status, city);
+    return;
   }
+  msg_seats_booked(first + 1, first + seats);
+}
 
-  msg_flight_no_seats(); // there weren't seats available, print "Sorry there's no more seats available!\n"
-  return;
+/****************************************************************
+ * Releases one seat, numbered from 1, of a flight              *
+ ****************************************************************/
+void flight_schedule_seat_release(city_id_t city)
+{
+  flight_time_t time;
+  int seat;
+
+  if (!time_get(&time) || !input_int(&seat)) {
+    return;
+  }
 
+  enum flight_status status = flight_seat_release(engine, city, time, seat - 1);
+  if (status == FLIGHT_SEAT_BAD) {
+    msg_seat_bad(seat);
+  } else if (status != FLIGHT_OK) {
+    msg_flight_status(status, city);
+  }
 }
 
-void flight_schedule_unschedule_seat(city_t city) {
-  struct flight_schedule *fs = flight_schedule_find(city);
+/****************************************************************
+ * Releases every seat of a flight                              *
+ ****************************************************************/
+void flight_schedule_seat_release_all(city_id_t city)
+{
+  flight_time_t time;
+
+  if (!time_get(&time)) {
+    return;
+  }
+
+  enum flight_status status = flight_seats_release_all(engine, city, time);
+  if (status != FLIGHT_OK) {
+    msg_flight_status(status, city);
+  }
+}
 
-  if (fs == NULL) { // if there isn't any city found
+/****************************************************************
+ * Prints which seats of a flight are taken                     *
+ ****************************************************************/
+void flight_schedule_seat_map(city_id_t city)
+{
+  flight_time_t time;
+  const struct flight *f;
 
-    msg_city_bad(city); // then print "No schedule for %s\n"
+  if (!time_get(&time)) {
     return;
+  }
 
+  enum flight_status status = flight_seat_flight(engine, city, time, &f);
+  if (status == FLIGHT_OK) {
+    msg_seat_map(flight_city_name(engine, city), f);
+  } else {
+    msg_flight_status(status, city);
   }
+}
 
-  else {
+/******************************************************************************
+ * Workload generator and replay benchmark                                    *
+ ******************************************************************************/
+// What the generator knows about a city so the commands it writes are
+// mostly ones that succeed
+struct gen_city {
+  char name[MAX_CITY_NAME_LEN+1];
+  bool active;                                   // has a schedule
+  int flights;                                   // flights in times
+  flight_time_t times[MAX_FLIGHTS_PER_CITY];     // departures not yet gone
+};
 
-    int j = 0; // intialized a int variable j
+// Departure minutes people want, a booking burst hits one of these
+static const int gen_peak_minutes[] = { 7 * 60, 8 * 60 + 30, 12 * 60, 17 * 60, 18 * 60 + 30, 21 * 60 };
+#define GEN_PEAKS (sizeof(gen_peak_minutes) / sizeof(gen_peak_minutes[0]))
 
-    if (1 != time_get(&j)) {  // if time_get equals anything other than a valid number then it returns. 
+/****************************************************************
+ * splitmix64, a small generator whose streams only depend on   *
+ * the seed so a workload is the same on every machine          *
+ ****************************************************************/
+static uint64_t gen_next(uint64_t *state)
+{
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
 
-      return;
-      
-    }
-  
-    for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY 
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/****************************************************************
+ * Returns a uniform double in [0, 1) and an int in [0, n)      *
+ ****************************************************************/
+static double gen_uniform(uint64_t *state)
+{
+  return (gen_next(state) >> 11) * 0x1.0p-53;
+}
 
-      if (j == fs->flights[i].time) {  // if the time was equal to the flight 
+static int gen_below(uint64_t *state, int n)
+{
+  return (int)(gen_uniform(state) * n);
+}
+
+/****************************************************************
+ * Returns a city drawn from the Zipf distribution whose        *
+ * cumulative probabilities are cdf                             *
+ ****************************************************************/
+static int gen_zipf(uint64_t *state, const double cdf[])
+{
+  double u = gen_uniform(state);
+  int lo = 0;
+  int hi = GEN_CITIES - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (cdf[mid] > u) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
 
-        if (fs->flights[i].capacity > fs->flights[i].available) { // and if there are available seats in the flight
+/****************************************************************
+ * Returns a departure time near a peak minute on one of the    *
+ * GEN_DAYS days starting with the clock's, at or after now     *
+ ****************************************************************/
+static flight_time_t gen_departure(uint64_t *state, flight_time_t now)
+{
+  int day = TIME_DAY(now) + gen_below(state, GEN_DAYS);
+  int minute = gen_peak_minutes[gen_below(state, GEN_PEAKS)] + gen_below(state, 121) - 60;
+  flight_time_t t = day * MINUTES_PER_DAY + minute;
 
-          fs->flights[i].available++;  // increment available seats at the flight
-          return;
+  return (t >= now) ? t : now + gen_below(state, MINUTES_PER_DAY);
+}
 
-        }
-        else {
+/****************************************************************
+ * Writes a command letter followed by a city line              *
+ ****************************************************************/
+static void gen_city_command(char command, const struct gen_city *c)
+{
+  out_char(command);
+  out_char(' ');
+  out_str(c->name);
+  out_char('\n');
+}
 
-        msg_flight_all_seats_empty(); // if there are seats available, print message
-        return;
+/****************************************************************
+ * Writes a workload of commands to stdout that can be replayed *
+ * with -r or sent to a server.  Cities are picked from a Zipf  *
+ * distribution so a few get most of the traffic, departures    *
+ * cluster around peak minutes and bookings come in bursts on   *
+ * one flight.  Flights and schedules are added and removed as  *
+ * the clock moves through the days.  The same seed always      *
+ * gives the same workload.  Replay it with at least GEN_CITIES *
+ * schedules.                                                   *
+ ****************************************************************/
+void flight_workload_generate(uint64_t seed, long commands)
+{
+  struct gen_city *cities = calloc(GEN_CITIES, sizeof(struct gen_city));
+  double *cdf = malloc(sizeof(double) * GEN_CITIES);
+  uint64_t state = seed;
+  flight_time_t now = TIME_MIN;
+  double total = 0;
+  long written = 0;
+  int burst = 0;        // bookings left in the current burst
+  int burst_city = 0;
+  flight_time_t burst_time = 0;
+
+  if (cities == NULL || cdf == NULL || commands <= 0) {
+    printf("ERROR: Bad workload parameters.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int i = 0; i < GEN_CITIES; i++) {
+    total += 1.0 / pow(i + 1, GEN_ZIPF_S);
+    cdf[i] = total;
+    snprintf(cities[i].name, sizeof(cities[i].name), "City%c%c%c",
+             'a' + i / 676 % 26, 'a' + i / 26 % 26, 'a' + i % 26);
+  }
+  for (int i = 0; i < GEN_CITIES; i++) {
+    cdf[i] /= total;
+  }
 
-        } 
+  while (written < commands) {
+    struct gen_city *c = &cities[gen_zipf(&state, cdf)];
+    double r = gen_uniform(&state);
+
+    if (written % GEN_CLOCK_EVERY == GEN_CLOCK_EVERY - 1) {
+      // move the clock, the generator forgets the flights that left
+      now += 1 + gen_below(&state, 30);
+      out_str("C ");
+      out_int(now);
+      out_char('\n');
+      for (int i = 0; i < GEN_CITIES; i++) {
+        struct gen_city *g = &cities[i];
+        int kept = 0;
+        for (int f = 0; f < g->flights; f++) {
+          if (g->times[f] >= now) {
+            g->times[kept++] = g->times[f];
+          }
+        }
+        g->flights = kept;
       }
+      burst = 0;
+    } else if (burst > 0) {
+      gen_city_command('s', &cities[burst_city]);
+      out_int(burst_time);
+      out_char('\n');
+      burst--;
+    } else if (!c->active) {
+      gen_city_command('A', c);
+      c->active = true;
+    } else if (c->flights == 0 || (r < 0.15 && c->flights < MAX_FLIGHTS_PER_CITY)) {
+      flight_time_t t = gen_departure(&state, now);
+      gen_city_command('a', c);
+      out_int(t);
+      out_char(' ');
+      out_int(50 + gen_below(&state, 250));
+      out_char('\n');
+      c->times[c->flights++] = t;
+    } else if (r < 0.17) {
+      // start a burst of bookings on one flight of a popular city
+      burst_city = c - cities;
+      burst_time = c->times[gen_below(&state, c->flights)];
+      burst = 1 + (int)(-log(1 - gen_uniform(&state)) * GEN_BURST_MEAN);
+      continue;
+    } else if (r < 0.50) {
+      flight_time_t t = c->times[gen_below(&state, c->flights)] - gen_below(&state, 60);
+      gen_city_command('s', c);
+      out_int((t > now) ? t : now);
+      out_char('\n');
+    } else if (r < 0.55) {
+      gen_city_command('u', c);
+      out_int(c->times[gen_below(&state, c->flights)]);
+      out_char('\n');
+    } else if (r < 0.60) {
+      int f = gen_below(&state, c->flights);
+      gen_city_command('r', c);
+      out_int(c->times[f]);
+      out_char('\n');
+      c->times[f] = c->times[--c->flights];
+    } else if (r < 0.62) {
+      out_str("b 2\n");
+      out_str(c->name);
+      out_char('\n');
+      out_int(c->times[0]);
+      out_str(" 2\n");
+      out_str(cities[gen_zipf(&state, cdf)].name);
+      out_char('\n');
+      out_int(now);
+      out_str(" 1\n");
+    } else if (r < 0.63) {
+      gen_city_command('R', c);
+      c->active = false;
+      c->flights = 0;
+    } else if (r < 0.70) {
+      out_str("T ");
+      out_int(now);
+      out_char(' ');
+      out_int(now + 120);
+      out_str(" 1\n");
+    } else if (r < 0.705) {
+      out_str("H\n");
+    } else {
+      gen_city_command('l', c);
     }
+    written++;
+  }
+  out_str("q\n");
+  out_flush();
+  free(cities);
+  free(cdf);
+}
+
+/****************************************************************
+ * Returns a monotonic time in nanoseconds                      *
+ ****************************************************************/
+static uint64_t replay_nanos(void)
+{
+  struct timespec ts;
 
-    msg_flight_bad_time(); // print an error message saying: "Sorry there's no flight scheduled on this time.\n"
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
+/****************************************************************
+ * Prints the n bytes of s as a quoted JSON string, escaping    *
+ * quotes, backslashes, control characters and bytes that are   *
+ * not ASCII, so the line stays valid UTF-8 for any file name   *
+ ****************************************************************/
+static void json_string(const char *s, size_t n)
+{
+  putchar('"');
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = s[i];
+
+    if (c == '"' || c == '\\') {
+      printf("\\%c", c);
+    } else if (c < 0x20 || c >= 0x7f) {
+      printf("\\u%04x", c);
+    } else {
+      putchar(c);
+    }
   }
+  putchar('"');
 }
 
+/****************************************************************
+ * Runs every command of the workload file path through the     *
+ * command handlers in this process and prints one line of JSON *
+ * with the throughput, the latency percentiles of each command *
+ * letter in nanoseconds and the peak resident set size.        *
+ * Responses are formatted into a buffer that is thrown away so *
+ * the terminal is not part of what is measured.                *
+ ****************************************************************/
+void flight_workload_replay(const char *path)
+{
+  struct stats_histogram *latency[UCHAR_MAX + 1] = { NULL };
+  struct out_buffer discard = { NULL, 0, 0, -1, false, -1 };
+  long size;
+  char *data = file_read(path, &size);
+  char command;
+  long executed = 0;
 
+  if (data == NULL) {
+    printf("ERROR: Unable to read workload %s.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  cmd_in.buf = data;
+  cmd_in.len = size;
+  cmd_in.pos = 0;
+  cmd_out = &discard;
+
+  uint64_t start = replay_nanos();
+  while (input_command(&command)) {
+    uint64_t t = replay_nanos();
+    bool more = flight_command_execute(command);
+    uint64_t elapsed = replay_nanos() - t;
+    unsigned char letter = command;
+
+    if (latency[letter] == NULL) {
+      latency[letter] = calloc(1, sizeof(struct stats_histogram));
+      if (latency[letter] == NULL) {
+        printf("ERROR: Unable to allocate a histogram.\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    stats_record(latency[letter], elapsed);
+    executed++;
+    discard.len = 0;
+    if (!more) {
+      break;
+    }
+  }
+  uint64_t stop = replay_nanos();
+
+  cmd_in.buf = NULL;
+  cmd_out = &stdout_buffer;
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  double seconds = (stop - start) / 1e9;
+
+  printf("{\"workload\":");
+  json_string(path, strlen(path));
+  printf(",\"commands\":%ld,\"seconds\":%.6f,"
+         "\"commands_per_sec\":%.0f,\"peak_rss_kb\":%ld,\"latency_ns\":{",
+         executed, seconds, executed / seconds, usage.ru_maxrss);
+  const char *sep = "";
+  for (int letter = 0; letter <= UCHAR_MAX; letter++) {
+    struct stats_histogram *h = latency[letter];
+    if (h != NULL) {
+      char name = letter;
+
+      printf("%s", sep);
+      json_string(&name, 1);
+      printf(":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p99\":%llu,"
+             "\"p999\":%llu,\"max\":%llu}",
+             (unsigned long long)h->count, (unsigned long long)(h->sum / h->count),
+             (unsigned long long)stats_percentile(h, 0.50),
+             (unsigned long long)stats_percentile(h, 0.99),
+             (unsigned long long)stats_percentile(h, 0.999),
+             (unsigned long long)h->max);
+      sep = ",";
+      free(h);
+    }
+  }
+  printf("}}\n");
+  free(discard.buf);
+  free(data);
+}
@@ -0,0 +1,546 @@
+/**
+ * DNA matching between a base sequence and a target sequence.  See
+ * dna_match.h for the interface.
+ **/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dna_match.h"
+
+#define DNA_NODE_NULL -1
+
+/* A node of the automaton: a prefix of one or more targets.  next is the
+ * full transition table, missing edges are filled in from the failure
+ * links when the automaton is built so a scan takes one lookup per base. */
+struct dna_node {
+    int next[DNA_NUM_BASES];  // node reached by each base, A T C G order
+    int target;   // first target that ends here or DNA_NODE_NULL
+    int output;   // nearest proper suffix node a target ends at
+};
+
+struct dna_automaton {
+    struct dna_node *nodes;   // nodes[0] is the empty prefix
+    int count;                // number of nodes
+    int *lens;                // length of each target
+    int *same;                // next target with the same bases
+};
+
+/* Rolling hash of a window: the sum of (symbol + 1) * DNA_HASH_BASE^k
+ * over its bases, the last base having k = 0, modulo 2^64 */
+#define DNA_HASH_BASE 0x100000001b3ULL
+
+struct dna_stream {
+    const char *target;       // the caller's target, len2 bases
+    int len2;
+    int threshold;
+    uint64_t target_hash;     // hash of the whole target
+    uint64_t hash;            // hash of the last len2 bases of the stream
+    uint64_t top;             // DNA_HASH_BASE^len2, removes the oldest base
+    long count;               // bases pushed so far
+    long contained;           // start of the last occurrence or -1
+    char *window;             // last len2 bases, base k at window[k % len2]
+    char *head;               // first len2 bases of the stream
+};
+
+/****************************************************************************
+ * Fills in m for a match of kind whose overlap starts at offset of the     *
+ * sequence it ends and merges head with the tail_len last bases of tail.   *
+ ****************************************************************************/
+static void dna_match_set(struct dna_match *m, enum dna_match_kind kind,
+                          int offset, int overlap,
+                          const char head[], int head_len,
+                          const char tail[], int tail_len) {
+    m->kind = kind;
+    m->offset = offset;
+    m->overlap = overlap;
+    m->head = head;
+    m->head_len = head_len;
+    m->tail = tail;
+    m->tail_len = tail_len;
+}
+
+/****************************************************************************
+ *  Tries to match the target sequence (len2 bases) against the base        *
+ *  sequence (len1 bases) and returns whether a match was found, filling in *
+ *  m either way.                                                           *
+ *                                                                          *
+ *  The target is first lined up at the end of the base with threshold      *
+ *  bases of overlap and slid left one position at a time.  It matches if   *
+ *  the base ends with the start of the target or if it appears inside the  *
+ *  base.  If not, the base is lined up at the end of the target the same   *
+ *  way to find a target that ends with the start of the base.              *
+ *                                                                          *
+ *  A target whose first len2 - 1 bases line up is taken to be inside the   *
+ *  base, its last base is not compared.                                    *
+ ****************************************************************************/
+bool dna_match(const char s1[], const char s2[], int len1, int len2,
+               int threshold, struct dna_match *m) {
+
+   int i;
+   int j;
+
+   int index_of_s1 = (len1 - threshold);
+   int index_of_s2 = (len2 - threshold);
+
+   for(i = index_of_s1; i >= 0; i--) {
+
+     for(j = 0; j < len2; j++){
+
+       if (i + j >= len1) {
+
+         // s1[i..len1) is s2[0..j): the base runs into the target
+         dna_match_set(m, DNA_MATCH_BASE_TARGET, i, j, s1, len1, s2 + j, len2 - j);
+         return 1;
+
+       }
+       else if (j == (len2 - 1)) {
+
+         dna_match_set(m, DNA_MATCH_CONTAINED, i, len2, s1, len1, NULL, 0);
+         return 1;
+
+         }
+
+       else if (s1[i + j] != s2[j]){
+
+         break;
+
+       }
+     }
+   }
+
+   // the other way round, the target runs into the base
+   for(i = index_of_s2; i >= 0; i--){
+
+     for(j = 0; j < len2; j++){
+
+       if (i + j >= len2){
+
+         // s2[i..len2) is s1[0..j)
+         dna_match_set(m, DNA_MATCH_TARGET_BASE, i, j, s2, len2, s1 + j, len1 - j);
+         return 1;
+
+        }
+
+        else if (j == (len2 - 1)) {
+
+          // only reached with i == 0: the target starts the base
+          dna_match_set(m, DNA_MATCH_CONTAINED, 0, len2, s1, len1, NULL, 0);
+          return 1;
+
+        }
+
+        else if (s2[i + j] != s1[j]) {
+
+          break;
+
+        }
+      }
+   }
+
+    dna_match_set(m, DNA_MATCH_NONE, -1, 0, NULL, 0, NULL, 0);
+    return 0;
+
+}
+
+
+/****************************************************************************
+ * Returns the symbol of base b, its index in bases[] of assignment-2.c,    *
+ * or -1 if it is not a base.                                               *
+ ****************************************************************************/
+static int dna_symbol(char b) {
+    switch (b) {
+    case 'A': return 0;
+    case 'T': return 1;
+    case 'C': return 2;
+    case 'G': return 3;
+    default:  return -1;
+    }
+}
+
+/****************************************************************************
+ * Compiles the n targets (targets[t] of lens[t] bases) into an Aho-        *
+ * Corasick automaton.  A target holding something other than a base can   *
+ * never be found and is left out.  Returns NULL if there is no memory.     *
+ ****************************************************************************/
+struct dna_automaton *dna_automaton_create(const char *const targets[],
+                                           const int lens[], int n) {
+    struct dna_automaton *ac = calloc(1, sizeof(struct dna_automaton));
+    int total = 1;
+    int *fail = NULL;
+    int *queue = NULL;
+
+    for (int t = 0; t < n; t++) {
+        total += lens[t];
+    }
+    if (ac == NULL
+        || (ac->nodes = malloc(sizeof(struct dna_node) * total)) == NULL
+        || (ac->lens = malloc(sizeof(int) * (n + 1))) == NULL
+        || (ac->same = malloc(sizeof(int) * (n + 1))) == NULL
+        || (fail = malloc(sizeof(int) * total)) == NULL
+        || (queue = malloc(sizeof(int) * total)) == NULL) {
+        free(fail);
+        dna_automaton_destroy(ac);
+        return NULL;
+    }
+
+    // the trie of the targets
+    ac->count = 1;
+    for (int i = 0; i < DNA_NUM_BASES; i++) {
+        ac->nodes[0].next[i] = DNA_NODE_NULL;
+    }
+    ac->nodes[0].target = DNA_NODE_NULL;
+    for (int t = n - 1; t >= 0; t--) {
+        int u = 0;
+        int i;
+
+        ac->lens[t] = lens[t];
+        ac->same[t] = DNA_NODE_NULL;
+        for (i = 0; i < lens[t] && dna_symbol(targets[t][i]) >= 0; i++) {
+            int b = dna_symbol(targets[t][i]);
+
+            if (ac->nodes[u].next[b] == DNA_NODE_NULL) {
+                struct dna_node *v = &ac->nodes[ac->count];
+
+                for (int k = 0; k < DNA_NUM_BASES; k++) {
+                    v->next[k] = DNA_NODE_NULL;
+                }
+                v->target = DNA_NODE_NULL;
+                ac->nodes[u].next[b] = ac->count++;
+            }
+            u = ac->nodes[u].next[b];
+        }
+        if (i == lens[t] && lens[t] > 0) {
+            // targets with the same bases are chained from the node,
+            // added last to first so they are reported in order
+            ac->same[t] = ac->nodes[u].target;
+            ac->nodes[u].target = t;
+        }
+    }
+
+    // breadth first: failure links, output links and the missing edges
+    int head = 0, tail = 0;
+
+    fail[0] = 0;
+    ac->nodes[0].output = DNA_NODE_NULL;
+    for (int b = 0; b < DNA_NUM_BASES; b++) {
+        int v = ac->nodes[0].next[b];
+
+        if (v == DNA_NODE_NULL) {
+            ac->nodes[0].next[b] = 0;
+        } else {
+            fail[v] = 0;
+            ac->nodes[v].output = DNA_NODE_NULL;
+            queue[tail++] = v;
+        }
+    }
+    while (head < tail) {
+        int u = queue[head++];
+
+        for (int b = 0; b < DNA_NUM_BASES; b++) {
+            int v = ac->nodes[u].next[b];
+            int f = ac->nodes[fail[u]].next[b];
+
+            if (v == DNA_NODE_NULL) {
+                ac->nodes[u].next[b] = f;
+                continue;
+            }
+            fail[v] = f;
+            ac->nodes[v].output = (ac->nodes[f].target != DNA_NODE_NULL) ? f : ac->nodes[f].output;
+            queue[tail++] = v;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return ac;
+}
+
+/****************************************************************************
+ * Frees an automaton                                                       *
+ ****************************************************************************/
+void dna_automaton_destroy(struct dna_automaton *ac) {
+    if (ac != NULL) {
+        free(ac->nodes);
+        free(ac->lens);
+        free(ac->same);
+        free(ac);
+    }
+}
+
+/****************************************************************************
+ * Streams len bases of base through the automaton once and calls hit for   *
+ * every occurrence of every target, in the order they end.  The cost is   *
+ * one table lookup per base plus one call per occurrence however many     *
+ * targets there are.  Something other than a base starts over.  The       *
+ * automaton is not changed so it can scan any number of sequences, on     *
+ * several threads at once.  Returns the number of occurrences.             *
+ ****************************************************************************/
+long dna_automaton_scan(const struct dna_automaton *ac, const char base[],
+                        int len, dna_hit *hit, void *arg) {
+    const struct dna_node *nodes = ac->nodes;
+    long found = 0;
+    int u = 0;
+
+    for (int i = 0; i < len; i++) {
+        int b = dna_symbol(base[i]);
+
+        u = (b < 0) ? 0 : nodes[u].next[b];
+        for (int v = (nodes[u].target != DNA_NODE_NULL) ? u : nodes[u].output;
+             v != DNA_NODE_NULL; v = nodes[v].output) {
+            for (int t = nodes[v].target; t != DNA_NODE_NULL; t = ac->same[t]) {
+                hit(arg, t, i - ac->lens[t] + 1);
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+
+/****************************************************************************
+ * Starts matching the len2 bases of target against a stream of bases with  *
+ * the same rules as dna_match.  target is not copied and must stay valid   *
+ * until the stream is destroyed.  Returns NULL if there is no memory.      *
+ ****************************************************************************/
+struct dna_stream *dna_stream_create(const char target[], int len2, int threshold) {
+    struct dna_stream *ds = calloc(1, sizeof(struct dna_stream));
+
+    if (ds == NULL || len2 <= 0
+        || (ds->window = malloc(len2)) == NULL
+        || (ds->head = malloc(len2)) == NULL) {
+        dna_stream_destroy(ds);
+        return NULL;
+    }
+    ds->target = target;
+    ds->len2 = len2;
+    ds->threshold = threshold;
+    ds->contained = -1;
+    ds->top = 1;
+    for (int j = 0; j < len2; j++) {
+        ds->target_hash = ds->target_hash * DNA_HASH_BASE + (uint64_t)(dna_symbol(target[j]) + 1);
+        ds->top *= DNA_HASH_BASE;
+    }
+    return ds;
+}
+
+/****************************************************************************
+ * Frees a stream                                                           *
+ ****************************************************************************/
+void dna_stream_destroy(struct dna_stream *ds) {
+    if (ds != NULL) {
+        free(ds->window);
+        free(ds->head);
+        free(ds);
+    }
+}
+
+/****************************************************************************
+ * Adds base b to the end of the stream, anything that is not a base is     *
+ * ignored.  Returns true if the target ends at b, setting offset to where  *
+ * it starts in the stream.  The hash of the window rolls forward in        *
+ * constant time and the window is only compared with the target when the   *
+ * hashes agree.                                                            *
+ ****************************************************************************/
+bool dna_stream_push(struct dna_stream *ds, char b, long *offset) {
+    int sym = dna_symbol(b);
+    int len2 = ds->len2;
+    int at = (int)(ds->count % len2);
+
+    if (sym < 0) {
+        return 0;
+    }
+    ds->hash = ds->hash * DNA_HASH_BASE + (uint64_t)(sym + 1);
+    if (ds->count < len2) {
+        ds->head[ds->count] = b;
+    } else {
+        // the oldest base of the window is where b goes
+        ds->hash -= ds->top * (uint64_t)(dna_symbol(ds->window[at]) + 1);
+    }
+    ds->window[at] = b;
+    ds->count++;
+
+    if (ds->count < len2 || ds->hash != ds->target_hash) {
+        return 0;
+    }
+    // the window starts just after b, wrapping around
+    at = (at + 1) % len2;
+    if (memcmp(ds->window + at, ds->target, len2 - at) != 0
+        || memcmp(ds->window, ds->target + len2 - at, at) != 0) {
+        return 0;
+    }
+    ds->contained = ds->count - len2;
+    *offset = ds->contained;
+    return 1;
+}
+
+/****************************************************************************
+ * Returns the base k bases before the end of a stream, 1 <= k <= len2.     *
+ ****************************************************************************/
+static char dna_stream_last(const struct dna_stream *ds, int k) {
+    return ds->window[(ds->count - k) % ds->len2];
+}
+
+/****************************************************************************
+ * Resolves the match of a stream that has ended from the bases it kept     *
+ * and returns whether there is one, filling in m either way.  The order is *
+ * the one of dna_match: the end of the stream running into the target,     *
+ * shortest overlap first, then the last occurrence of the target, then the *
+ * target running into the start of the stream.  Unlike dna_match every     *
+ * base of a contained target is compared.  The stream can go on after.     *
+ ****************************************************************************/
+bool dna_stream_end(const struct dna_stream *ds, struct dna_stream_match *m) {
+    int len2 = ds->len2;
+    int k;
+    int j;
+
+    for (k = (ds->threshold > 1) ? ds->threshold : 1; k < len2 && k <= ds->count; k++) {
+        // the last k bases of the stream are the first k of the target
+        for (j = 0; j < k && dna_stream_last(ds, k - j) == ds->target[j]; j++) {
+        }
+        if (j == k) {
+            m->kind = DNA_MATCH_BASE_TARGET;
+            m->offset = ds->count - k;
+            m->overlap = k;
+            return 1;
+        }
+    }
+
+    if (ds->contained >= 0) {
+        m->kind = DNA_MATCH_CONTAINED;
+        m->offset = ds->contained;
+        m->overlap = len2;
+        return 1;
+    }
+
+    for (k = (ds->threshold > 1) ? ds->threshold : 1; k < len2 && k <= ds->count; k++) {
+        // the last k bases of the target are the first k of the stream
+        if (memcmp(ds->target + len2 - k, ds->head, k) == 0) {
+            m->kind = DNA_MATCH_TARGET_BASE;
+            m->offset = len2 - k;
+            m->overlap = k;
+            return 1;
+        }
+    }
+
+    m->kind = DNA_MATCH_NONE;
+    m->offset = -1;
+    m->overlap = 0;
+    return 0;
+}
+
+
+/****************************************************************************
+ * Scrambles a packed k-mer so minimizers are not biased towards A.  The    *
+ * mix is invertible so different k-mers get different hashes.              *
+ ****************************************************************************/
+static uint64_t dna_kmer_hash(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/****************************************************************************
+ * Orders hashes for qsort                                                  *
+ ****************************************************************************/
+static int dna_hash_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/****************************************************************************
+ * Fills sketch with the (w, k) minimizers of the len bases of s, sorted    *
+ * and without repeats, and returns how many there are.  k-mers are packed  *
+ * 2 bits a base and roll along s so each base costs a shift, a hash and a  *
+ * look at the last w hashes.  Something other than a base ends the k-mers *
+ * before it.  A run of bases too short for w k-mers gives the smallest of  *
+ * the ones it has so short sequences still have a sketch.                  *
+ * k must be 1 to DNA_SKETCH_MAX_K and w 1 to DNA_SKETCH_MAX_W.             *
+ ****************************************************************************/
+int dna_sketch(const char s[], int len, int k, int w, uint64_t sketch[]) {
+    uint64_t mask = (k == DNA_SKETCH_MAX_K) ? UINT64_MAX : ((uint64_t)1 << (2 * k)) - 1;
+    uint64_t window[DNA_SKETCH_MAX_W];   // hashes of the last w k-mers
+    uint64_t kmer = 0;
+    int run = 0;      // bases since something that is not a base
+    int kmers = 0;    // k-mers of the run
+    int n = 0;
+
+    for (int i = 0; i <= len; i++) {
+        int sym = (i < len) ? dna_symbol(s[i]) : -1;
+
+        if (sym < 0) {
+            if (kmers > 0 && kmers < w) {
+                // too short for a whole window, take what there is
+                uint64_t min = window[0];
+
+                for (int j = 1; j < kmers; j++) {
+                    min = (window[j] < min) ? window[j] : min;
+                }
+                sketch[n++] = min;
+            }
+            run = 0;
+            kmers = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | (uint64_t)sym) & mask;
+        if (++run < k) {
+            continue;
+        }
+        window[kmers % w] = dna_kmer_hash(kmer);
+        if (++kmers < w) {
+            continue;
+        }
+
+        uint64_t min = window[0];
+
+        for (int j = 1; j < w; j++) {
+            min = (window[j] < min) ? window[j] : min;
+        }
+        // neighbouring windows mostly share their minimizer
+        if (n == 0 || sketch[n - 1] != min) {
+            sketch[n++] = min;
+        }
+    }
+
+    qsort(sketch, n, sizeof(uint64_t), dna_hash_compare);
+    int unique = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (unique == 0 || sketch[unique - 1] != sketch[i]) {
+            sketch[unique++] = sketch[i];
+        }
+    }
+    return unique;
+}
+
+/****************************************************************************
+ * Returns whether two sketches have a minimizer in common, walking both    *
+ * sorted sketches once.  An empty sketch, of a sequence shorter than k,    *
+ * says nothing about the sequence so it shares with every sketch.          *
+ ****************************************************************************/
+bool dna_sketch_share(const uint64_t a[], int na, const uint64_t b[], int nb) {
+    int i = 0;
+    int j = 0;
+
+    if (na == 0 || nb == 0) {
+        return 1;
+    }
+    while (i < na && j < nb) {
+        if (a[i] == b[j]) {
+            return 1;
+        }
+        if (a[i] < b[j]) {
+            i++;
+        } else {
+            j++;
+        }
+    }
+    return 0;
+}
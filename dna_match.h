@@ -0,0 +1,101 @@
+/**
+ * DNA matching between a base sequence and a target sequence as a
+ * library.  Nothing here reads input or prints and there is no state
+ * outside the arguments, so matches can run on any number of threads.
+ * assignment-2.c is the command line front end over it.
+ *
+ * A match is returned without copying: the merged sequence is described
+ * as a head followed by a tail, both pointing into the caller's arrays.
+ *
+ * Many targets can be looked for at once by compiling them into a
+ * dna_automaton, which is read only once built and scans any number of
+ * base sequences.
+ *
+ * A dna_stream matches a target against a base sequence that is never
+ * held whole, keeping only as many bases as the target has.
+ *
+ * Sketches of minimizers rule out pairs that cannot match before they are
+ * compared, for matching many sequences against each other.
+ **/
+
+#ifndef DNA_MATCH_H
+#define DNA_MATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* How the target lines up with the base */
+enum dna_match_kind {
+    DNA_MATCH_NONE,         // no overlap of at least threshold bases
+    DNA_MATCH_CONTAINED,    // the target appears inside the base
+    DNA_MATCH_BASE_TARGET,  // the end of the base is the start of the target
+    DNA_MATCH_TARGET_BASE,  // the end of the target is the start of the base
+};
+
+/* Result of dna_match.  The merged sequence is head[0..head_len)
+ * followed by tail[0..tail_len). */
+struct dna_match {
+    enum dna_match_kind kind;
+    int offset;    // where the overlap starts in the sequence it ends:
+                   // the base, or the target for DNA_MATCH_TARGET_BASE
+    int overlap;   // number of bases the two sequences share
+    const char *head;
+    int head_len;
+    const char *tail;
+    int tail_len;
+};
+
+bool dna_match(const char base[], const char target[], int len1, int len2,
+               int threshold, struct dna_match *m);
+
+/* Number of symbols of the automaton, the bases A, T, C and G */
+#define DNA_NUM_BASES 4
+
+/* A set of targets compiled for finding all of them in a base sequence
+ * in one pass.  Only used through pointers. */
+struct dna_automaton;
+
+/* Called for each occurrence of target number target (its index in the
+ * set) starting at offset of the base sequence */
+typedef void dna_hit(void *arg, int target, int offset);
+
+struct dna_automaton *dna_automaton_create(const char *const targets[],
+                                           const int lens[], int n);
+void dna_automaton_destroy(struct dna_automaton *ac);
+long dna_automaton_scan(const struct dna_automaton *ac, const char base[],
+                        int len, dna_hit *hit, void *arg);
+
+/* A target matched against a base sequence that arrives one base at a
+ * time and may never end.  Only used through pointers. */
+struct dna_stream;
+
+/* How a stream lined up with its target, found when the stream ends */
+struct dna_stream_match {
+    enum dna_match_kind kind;
+    long offset;   // where the overlap starts in the sequence it ends:
+                   // the stream, or the target for DNA_MATCH_TARGET_BASE
+    int overlap;   // number of bases the two sequences share
+};
+
+struct dna_stream *dna_stream_create(const char target[], int len2, int threshold);
+void dna_stream_destroy(struct dna_stream *ds);
+bool dna_stream_push(struct dna_stream *ds, char b, long *offset);
+bool dna_stream_end(const struct dna_stream *ds, struct dna_stream_match *m);
+
+/* Sketches.  The sketch of a sequence is the sorted set of its (w, k)
+ * minimizers: the smallest hash of each w consecutive k-mers.  Two
+ * sequences that share a run of at least k + w - 1 bases share a
+ * minimizer, so with k + w - 1 <= threshold (and < len2) a pair whose
+ * sketches share nothing cannot match and dna_match need not be called.
+ * Larger k and w make sketches smaller and more pairs rejected but can
+ * miss overlaps shorter than k + w - 1.  A sketch has room for at most
+ * len - k + 1 hashes.  A sequence shorter than k has an empty sketch,
+ * which dna_sketch_share treats as sharing with everything so the pair
+ * is still compared. */
+#define DNA_SKETCH_MAX_K 32   // k-mers are packed 2 bits a base in 64 bits
+#define DNA_SKETCH_MAX_W 64
+
+int dna_sketch(const char s[], int len, int k, int w, uint64_t sketch[]);
+bool dna_sketch_share(const uint64_t a[], int na, const uint64_t b[], int nb);
+
+#endif
@@ -0,0 +1,303 @@
+/**
+ * Packed files of DNA sequences.  See dna_pack.h for the format and the
+ * interface.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dna_pack.h"
+
+// Bases by their 2 bit code
+static const char dna_pack_bases[] = {'A', 'T', 'C', 'G'};
+
+struct dna_pack_writer {
+    FILE *out;
+    unsigned char *buffer;   // DNA_PACK_BUFFER_LEN bytes waiting to be written
+    size_t used;             // bytes of buffer in use
+    uint64_t written;        // bytes already written to out
+    uint64_t *index;         // file offset of each record
+    long count;              // records written
+    long capacity;           // room in index
+    unsigned partial;        // bases of a byte not full yet, first one lowest
+    int bits;                // bits of partial in use
+    bool failed;             // a write went wrong
+};
+
+struct dna_pack_file {
+    unsigned char *data;     // the whole file
+    uint64_t size;
+    uint64_t index;          // offset of the index
+    long count;              // records in the file
+};
+
+/****************************************************************************
+ * Writes out the buffer of w                                               *
+ ****************************************************************************/
+static void pack_flush(struct dna_pack_writer *w) {
+    if (w->used > 0 && fwrite(w->buffer, 1, w->used, w->out) != w->used) {
+        w->failed = true;
+    }
+    w->written += w->used;
+    w->used = 0;
+}
+
+/****************************************************************************
+ * Appends byte b to the buffer of w                                        *
+ ****************************************************************************/
+static void pack_byte(struct dna_pack_writer *w, unsigned b) {
+    if (w->used == DNA_PACK_BUFFER_LEN) {
+        pack_flush(w);
+    }
+    w->buffer[w->used++] = (unsigned char)b;
+}
+
+/****************************************************************************
+ * Appends the len low bytes of v, lowest first                             *
+ ****************************************************************************/
+static void pack_number(struct dna_pack_writer *w, uint64_t v, int len) {
+    for (int i = 0; i < len; i++) {
+        pack_byte(w, (unsigned)(v >> (8 * i)) & 0xFF);
+    }
+}
+
+/****************************************************************************
+ * Returns the 2 bit code of base b.  Bits 1 and 2 of the ASCII letters     *
+ * tell the four apart: A has neither, T bit 2, C bit 1 and G both.         *
+ ****************************************************************************/
+static unsigned pack_code(char b) {
+    return (((unsigned)b >> 1) & 1) << 1 | (((unsigned)b >> 2) & 1);
+}
+
+/****************************************************************************
+ * Appends the len bases of s to the record being written.  Once a byte     *
+ * boundary is reached 8 bases at a time are encoded in a 64 bit word: the  *
+ * codes of all 8 letters are taken at once and then gathered into 2 bytes. *
+ ****************************************************************************/
+static void pack_bases(struct dna_pack_writer *w, const char s[], int len) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    int i = 0;
+
+    // finish the byte the last part of the record left
+    for (; i < len && w->bits != 0; i++) {
+        w->partial |= pack_code(s[i]) << w->bits;
+        w->bits += 2;
+        if (w->bits == 8) {
+            pack_byte(w, w->partial);
+            w->partial = 0;
+            w->bits = 0;
+        }
+    }
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v = 0;
+        uint64_t codes;
+
+        for (int j = 0; j < 8; j++) {
+            v |= (uint64_t)(unsigned char)s[i + j] << (8 * j);
+        }
+        // a code in the low 2 bits of each byte, then 2 bits a base
+        codes = ((v >> 1) & ones) << 1 | ((v >> 2) & ones);
+        codes = (codes | (codes >> 6)) & 0x000F000F000F000FULL;
+        codes = (codes | (codes >> 12)) & 0x000000FF000000FFULL;
+        codes = (codes | (codes >> 24)) & 0xFFFF;
+        if (w->used + 2 > DNA_PACK_BUFFER_LEN) {
+            pack_flush(w);
+        }
+        w->buffer[w->used++] = (unsigned char)(codes & 0xFF);
+        w->buffer[w->used++] = (unsigned char)(codes >> 8);
+    }
+
+    for (; i < len; i++) {
+        w->partial |= pack_code(s[i]) << w->bits;
+        w->bits += 2;
+        if (w->bits == 8) {
+            pack_byte(w, w->partial);
+            w->partial = 0;
+            w->bits = 0;
+        }
+    }
+}
+
+/****************************************************************************
+ * Creates a packed file at path, replacing any file there                  *
+ ****************************************************************************/
+struct dna_pack_writer *dna_pack_create(const char *path) {
+    struct dna_pack_writer *w = calloc(1, sizeof(struct dna_pack_writer));
+
+    if (w == NULL || (w->buffer = malloc(DNA_PACK_BUFFER_LEN)) == NULL
+        || (w->out = fopen(path, "wb")) == NULL) {
+        if (w != NULL) {
+            free(w->buffer);
+        }
+        free(w);
+        return NULL;
+    }
+    for (int i = 0; i < 4; i++) {
+        pack_byte(w, (unsigned char)DNA_PACK_MAGIC[i]);
+    }
+    return w;
+}
+
+/****************************************************************************
+ * Writes a record of the sequence head[0..head_len) followed by            *
+ * tail[0..tail_len), the two parts of a struct dna_match.  Both must hold  *
+ * only the bases A, T, C and G.  Returns false if there is no memory for   *
+ * the index or a write failed.                                             *
+ ****************************************************************************/
+bool dna_pack_write(struct dna_pack_writer *w, const char head[], int head_len,
+                    const char tail[], int tail_len) {
+    if (w->count == w->capacity) {
+        long capacity = (w->capacity > 0) ? 2 * w->capacity : 1024;
+        uint64_t *index = realloc(w->index, sizeof(uint64_t) * capacity);
+
+        if (index == NULL) {
+            return false;
+        }
+        w->index = index;
+        w->capacity = capacity;
+    }
+    w->index[w->count++] = w->written + w->used;
+
+    pack_number(w, (uint64_t)(head_len + tail_len), 4);
+    pack_bases(w, head, head_len);
+    pack_bases(w, tail, tail_len);
+    if (w->bits != 0) {
+        pack_byte(w, w->partial);
+        w->partial = 0;
+        w->bits = 0;
+    }
+    return !w->failed;
+}
+
+/****************************************************************************
+ * Writes the index and trailer, closes the file and frees w.  Returns      *
+ * false if any write failed.                                               *
+ ****************************************************************************/
+bool dna_pack_close(struct dna_pack_writer *w) {
+    uint64_t index = w->written + w->used;
+    bool ok;
+
+    for (long i = 0; i < w->count; i++) {
+        pack_number(w, w->index[i], 8);
+    }
+    pack_number(w, index, 8);
+    pack_number(w, (uint64_t)w->count, 8);
+    for (int i = 0; i < 8; i++) {
+        pack_byte(w, (unsigned char)DNA_PACK_INDEX_MAGIC[i]);
+    }
+    pack_flush(w);
+
+    ok = !w->failed;
+    if (fclose(w->out) != 0) {
+        ok = false;
+    }
+    free(w->index);
+    free(w->buffer);
+    free(w);
+    return ok;
+}
+
+/****************************************************************************
+ * Returns the little endian number of len bytes at p                      *
+ ****************************************************************************/
+static uint64_t pack_get(const unsigned char *p, int len) {
+    uint64_t v = 0;
+
+    for (int i = 0; i < len; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+/****************************************************************************
+ * Reads the packed file at path into memory and checks its magic, index   *
+ * and that every record fits before the index.  Returns NULL if the file   *
+ * cannot be read or is not a packed file.                                  *
+ ****************************************************************************/
+struct dna_pack_file *dna_pack_open(const char *path) {
+    struct dna_pack_file *f = calloc(1, sizeof(struct dna_pack_file));
+    FILE *in = fopen(path, "rb");
+    long size;
+    uint64_t count;
+
+    if (f == NULL || in == NULL || fseek(in, 0, SEEK_END) != 0
+        || (size = ftell(in)) < 4 + DNA_PACK_TRAILER_LEN
+        || fseek(in, 0, SEEK_SET) != 0
+        || (f->data = malloc(size)) == NULL
+        || fread(f->data, 1, size, in) != (size_t)size) {
+        goto bad;
+    }
+    fclose(in);
+    in = NULL;
+
+    // the trailer says where the index is and how long it is
+    f->size = size;
+    f->index = pack_get(f->data + size - DNA_PACK_TRAILER_LEN, 8);
+    count = pack_get(f->data + size - DNA_PACK_TRAILER_LEN + 8, 8);
+    if (memcmp(f->data, DNA_PACK_MAGIC, 4) != 0
+        || memcmp(f->data + size - 8, DNA_PACK_INDEX_MAGIC, 8) != 0
+        || f->index < 4 || count > f->size / 8
+        || f->index + 8 * count != f->size - DNA_PACK_TRAILER_LEN) {
+        goto bad;
+    }
+    f->count = (long)count;
+
+    for (long r = 0; r < f->count; r++) {
+        uint64_t at = pack_get(f->data + f->index + 8 * r, 8);
+
+        if (at < 4 || at + 4 > f->index
+            || at + 4 + (pack_get(f->data + at, 4) + 3) / 4 > f->index) {
+            goto bad;
+        }
+    }
+    return f;
+
+bad:
+    if (in != NULL) {
+        fclose(in);
+    }
+    dna_pack_free(f);
+    return NULL;
+}
+
+/****************************************************************************
+ * Frees a file read by dna_pack_open                                       *
+ ****************************************************************************/
+void dna_pack_free(struct dna_pack_file *f) {
+    if (f != NULL) {
+        free(f->data);
+        free(f);
+    }
+}
+
+/****************************************************************************
+ * Returns the number of records of a file                                  *
+ ****************************************************************************/
+long dna_pack_count(const struct dna_pack_file *f) {
+    return f->count;
+}
+
+/****************************************************************************
+ * Returns the number of bases of a record or -1 if there is no such record *
+ ****************************************************************************/
+long dna_pack_length(const struct dna_pack_file *f, long record) {
+    if (record < 0 || record >= f->count) {
+        return -1;
+    }
+    return (long)pack_get(f->data + pack_get(f->data + f->index + 8 * record, 8), 4);
+}
+
+/****************************************************************************
+ * Unpacks a record into s, which has room for dna_pack_length bases        *
+ ****************************************************************************/
+void dna_pack_unpack(const struct dna_pack_file *f, long record, char s[]) {
+    uint64_t at = pack_get(f->data + f->index + 8 * record, 8);
+    long len = (long)pack_get(f->data + at, 4);
+    const unsigned char *p = f->data + at + 4;
+
+    for (long i = 0; i < len; i++) {
+        s[i] = dna_pack_bases[(p[i / 4] >> (2 * (i % 4))) & 3];
+    }
+}
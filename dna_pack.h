@@ -0,0 +1,51 @@
+/**
+ * Packed files of DNA sequences.  Each base takes 2 bits, A T C G in the
+ * order of bases[] in assignment-2.c, so a file is about a quarter of the
+ * size of the same sequences printed one character a base.
+ *
+ * A file is the magic "DNA2", then one record a sequence and an index:
+ *
+ *   record   4 byte length in bases, then (length + 3) / 4 bytes holding
+ *            4 bases each, the first base in the low 2 bits
+ *   index    8 byte file offset of each record
+ *   trailer  8 byte offset of the index, 8 byte number of records and the
+ *            magic "DNA2INDX"
+ *
+ * All numbers are little endian.  The index lets a reader go straight to
+ * any record.  dna_unpack.c prints the sequences of a file.
+ *
+ * Functions return NULL or false when a file cannot be opened, written or
+ * read, and leave the message to the caller.
+ **/
+
+#ifndef DNA_PACK_H
+#define DNA_PACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DNA_PACK_MAGIC "DNA2"
+#define DNA_PACK_INDEX_MAGIC "DNA2INDX"
+#define DNA_PACK_TRAILER_LEN 24
+#define DNA_PACK_BUFFER_LEN (1 << 20)   // bytes encoded before each write
+
+// A file being written.  Only used through pointers.
+struct dna_pack_writer;
+
+// A file read into memory.  Only used through pointers.
+struct dna_pack_file;
+
+// Writing
+struct dna_pack_writer *dna_pack_create(const char *path);
+bool dna_pack_write(struct dna_pack_writer *w, const char head[], int head_len,
+                    const char tail[], int tail_len);
+bool dna_pack_close(struct dna_pack_writer *w);
+
+// Reading
+struct dna_pack_file *dna_pack_open(const char *path);
+void dna_pack_free(struct dna_pack_file *f);
+long dna_pack_count(const struct dna_pack_file *f);
+long dna_pack_length(const struct dna_pack_file *f, long record);
+void dna_pack_unpack(const struct dna_pack_file *f, long record, char s[]);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * Prints the sequences of a packed file (see dna_pack.h) one a line, the
+ * way assignment-2 prints them without "-o".  Build with
+ * "gcc -o dna_unpack dna_unpack.c dna_pack.c".
+ *
+ *   dna_unpack <file>            every sequence
+ *   dna_unpack <file> <record>   only that one, counting from 0
+ *   dna_unpack -c <file>         the number of sequences
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dna_pack.h"
+
+int main(int argc, char *argv[]) {
+    struct dna_pack_file *f;
+    bool count_only = argc > 1 && strcmp(argv[1], "-c") == 0;
+    const char *path;
+    long first = 0, last;
+    char *s = NULL;
+    long room = 0;
+
+    if (argc < (count_only ? 3 : 2)) {
+        printf("ERROR: Usage: dna_unpack [-c] <file> [record]\n");
+        exit(EXIT_FAILURE);
+    }
+    path = argv[count_only ? 2 : 1];
+    f = dna_pack_open(path);
+    if (f == NULL) {
+        printf("ERROR: Unable to read packed file %s.\n", path);
+        exit(EXIT_FAILURE);
+    }
+    if (count_only) {
+        printf("%ld\n", dna_pack_count(f));
+        dna_pack_free(f);
+        return EXIT_SUCCESS;
+    }
+
+    last = dna_pack_count(f) - 1;
+    if (argc > 2) {
+        first = last = atol(argv[2]);
+        if (dna_pack_length(f, first) < 0) {
+            printf("ERROR: No record %s in %s.\n", argv[2], path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (long r = first; r <= last; r++) {
+        long len = dna_pack_length(f, r);
+
+        if (len + 1 > room) {
+            room = 2 * (len + 1);
+            free(s);
+            s = malloc(room);
+            if (s == NULL) {
+                printf("ERROR: Unable to allocate %ld bases.\n", len);
+                exit(EXIT_FAILURE);
+            }
+        }
+        dna_pack_unpack(f, r, s);
+        s[len] = '\n';
+        fwrite(s, 1, len + 1, stdout);
+    }
+
+    free(s);
+    dna_pack_free(f);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,2474 @@
+/**
+ * Flight engine: the schedules of the flight management system and the
+ * indexes over them.  See flight_engine.h for the interface.
+ **/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "flight_engine.h"
+
+// Limit constants
+#define CITY_INTERN_MIN_IDS 64   // initial number of ids
+#define BULK_MAX_THREADS 64        // most threads parsing a file
+#define BULK_MIN_CHUNK (1 << 20)   // fewest bytes worth a thread
+#define SNAP_BITS 5                // city id bits per snapshot tree level
+#define SNAP_FANOUT (1 << SNAP_BITS)
+
+// Departure time index definitions
+#define TIME_SLOTS (TIME_MAX - TIME_MIN + 1)       // one bucket per minute of a day
+#define TIME_INDEX_WORDS ((TIME_SLOTS + 63) / 64)  // words in occupancy bitmap
+#define FLIGHT_HANDLE_NULL -1
+
+/******************************************************************************
+ * Structure and Type definitions                                             *
+ ******************************************************************************/
+// Structure for an individual flight schedule
+// The main data structure of the engine is an Array of these structures
+// Each structure will be placed on one of two linked lists:
+//                free or active
+// Initially the active list will be empty and all the schedules
+// will be on the free list.  Adding a schedule is finding the first
+// free schedule on the free list, removing it from the free list,
+// setting its destination city and putting it on the active list
+struct flight_schedule {
+  city_id_t destination;                       // destination city id
+  struct flight flights[MAX_FLIGHTS_PER_CITY]; // array of flights to the city
+  struct flight_schedule *next;                // link list next pointer
+  struct flight_schedule *prev;                // link list prev pointer
+};
+
+// Links of a single flight slot in the time index.  A flight slot is
+// named by its handle: (schedule index * MAX_FLIGHTS_PER_CITY) + slot
+struct time_link {
+  int next;  // next flight handle departing in the same minute
+  int prev;  // previous flight handle departing in the same minute
+};
+
+// The departures of one day of the time index.  Every minute of the day
+// has a bucket holding a doubly linked list of flight handles and the
+// occupancy bitmap lets a range query jump directly to the next minute
+// that has a departure.  A day is allocated when its first flight is
+// added and freed in one go once the clock has passed it.
+struct time_day {
+  int day;                               // day number of the departures
+  int head[TIME_SLOTS];                  // first flight handle per minute
+  uint64_t occupied[TIME_INDEX_WORDS];   // bit set for non-empty minutes
+  long hour_seats[HOURS_PER_DAY];        // available seats per hour
+};
+
+// Time ordered secondary index over the departure times of all the
+// active flights.  It is a two level timing wheel: a wheel of the
+// SCHEDULE_DAYS days starting with the clock's day, each live day holding
+// the minute buckets of its departures.  Flights can only depart between
+// the clock and the end of the last day of the wheel so a day's slot is
+// day % SCHEDULE_DAYS.  Advancing the clock retires the flights that have
+// departed and frees the days that are over.  Because qsort moves
+// flights around inside a schedule, a schedule's flights are detached
+// from the index before it is modified and attached again once it is
+// sorted.
+struct time_index {
+  struct time_link *links;               // one link per flight slot
+  flight_time_t now;                     // the clock
+  struct time_day *days[SCHEDULE_DAYS];  // live days by day % SCHEDULE_DAYS
+  uint64_t live_days;                    // bit set for allocated days
+};
+
+// Node of the compact radix trie indexing the names of the active
+// schedules.  Each node holds the label of the edge leading to it and
+// its children are kept on a sibling list sorted by their first letter.
+// Chains of single children are merged into one node so the trie has at
+// most two nodes per city.
+struct city_trie {
+  city_id_t city;               // city whose name ends here or CITY_ID_NULL
+  struct city_trie *child;      // first child
+  struct city_trie *sibling;    // next sibling of the same parent
+  unsigned char len;            // length of the edge label
+  char label[];                 // edge label, not null terminated
+};
+
+// City names are interned: each distinct name read gets a small integer
+// id, kept in an open addressing hash table.  Schedules and trie nodes
+// store the id instead of a copy of the name, and lookups by city are
+// then a plain index into schedules.  Ids are never released: a city
+// keeps its id after its schedule is removed.
+struct city_intern {
+  city_t *names;                       // name of each id
+  struct flight_schedule **schedules;  // active schedule of each id or NULL
+  uint32_t count;                      // number of ids handed out
+  uint32_t capacity;                   // length of names and schedules
+  city_id_t *table;                    // open addressing hash of the ids
+  uint32_t table_size;                 // power of 2, at least 2 * capacity
+};
+
+// The schedules are also kept in a persistent radix tree keyed by city
+// id whose nodes and leaves never change once they are shared, so taking
+// a snapshot is taking a reference to the root.  The engine updates a
+// node in place while it is the node's only owner and copies the path
+// down to a leaf once a snapshot shares it, so a snapshot costs memory
+// only for what changes after it is taken.  The counts are atomic so
+// snapshots can be released on other threads.
+struct snap_ref {
+  atomic_uint refs;    // owners: the engine, snapshots and parent nodes
+};
+
+// Leaf of the snapshot tree, the state of one active schedule
+struct snap_image {
+  struct snap_ref ref;
+  city_t name;
+  int count;                                    // flights in flights
+  struct flight flights[MAX_FLIGHTS_PER_CITY];  // time order, no seat maps
+};
+
+// Inner node of the snapshot tree.  The slots of a node of height 0
+// hold images, higher nodes hold nodes one lower.
+struct snap_node {
+  struct snap_ref ref;
+  struct snap_ref *slot[SNAP_FANOUT];
+};
+
+struct flight_snapshot {
+  struct snap_ref *root;   // tree of the schedules when taken
+  int height;              // height of root
+  uint64_t version;        // number of the snapshot in its engine
+  flight_time_t now;       // the clock when taken
+};
+
+// Everything an engine owns.  The engine uses two linked lists of
+// Schedules.  See comments of struct flight_schedule above for details
+struct flight_engine {
+  struct flight_schedule *schedules;         // the array of all schedules
+  long count;                                // length of schedules
+  struct flight_schedule *schedules_free;    // free list
+  struct flight_schedule *schedules_active;  // active list
+  struct time_index time_index;              // departures of every flight
+  struct city_trie *trie_root;               // names of the active schedules
+  struct city_intern intern;                 // every city name seen
+  bool seat_maps;                            // flights keep seat maps
+  struct snap_ref *snap_root;                // tree the next snapshot shares
+  int snap_height;                           // height of snap_root
+  uint64_t snap_version;                     // snapshots taken
+#ifdef FLIGHT_STATS
+  struct flight_stats stats;
+#endif
+};
+
+// One valid line of a bulk loaded csv file
+struct bulk_row {
+  const char *name;        // city name inside the file contents
+  int name_len;
+  flight_time_t time;
+  int capacity;
+  int available;
+  city_id_t city;          // id of the name once it is interned
+};
+
+// The part of a bulk loaded file parsed by one thread
+struct bulk_chunk {
+  const struct flight_engine *fe;  // the engine whose clock rows must follow
+  const char *begin;       // first byte of the chunk, at a line start
+  const char *end;         // one past the last byte of the chunk
+  bool first;              // the chunk starts the file and may have a header
+  struct bulk_row *rows;   // rows parsed from the chunk
+  size_t count;
+  long skipped;            // lines that are not a valid row
+};
+
+#ifdef FLIGHT_STATS
+static void stats_free_initialize(struct flight_engine *fe, long n);
+static void stats_free_depth(struct flight_engine *fe, long delta);
+#define STATS_FREE(fe, delta)   stats_free_depth((fe), (delta))
+#define STATS_FREE_INIT(fe, n)  stats_free_initialize((fe), (n))
+#else
+#define STATS_FREE(fe, delta)
+#define STATS_FREE_INIT(fe, n)
+#endif
+
+/******************************************************************************
+ * Function prototypes                                                        *
+ ******************************************************************************/
+static void flight_schedule_reset(struct flight_schedule *fs);
+static void flight_schedule_initialize(struct flight_engine *fe);
+static struct flight_schedule * flight_schedule_find(struct flight_engine *fe, city_id_t city);
+static struct flight_schedule * flight_schedule_allocate(struct flight_engine *fe);
+static struct flight_schedule * flight_schedule_open(struct flight_engine *fe, city_id_t city);
+static void flight_schedule_free(struct flight_engine *fe, struct flight_schedule *fs);
+static void flight_schedule_clear_flight(struct flight_engine *fe, struct flight_schedule *fs, int i);
+static void flight_schedule_sort_flights_by_time(struct flight_engine *fe, struct flight_schedule *fs);
+static int  flight_compare_time(const void *a, const void *b);
+
+static bool time_index_initialize(struct flight_engine *fe);
+static void time_index_attach(struct flight_engine *fe, struct flight_schedule *fs);
+static void time_index_detach(struct flight_engine *fe, struct flight_schedule *fs);
+static void time_index_seats_changed(struct flight_engine *fe, flight_time_t time, int delta);
+static flight_time_t time_index_next(const struct flight_engine *fe, flight_time_t from, flight_time_t to);
+static int  time_index_advance(struct flight_engine *fe, flight_time_t to);
+
+static void city_trie_insert(struct flight_engine *fe, city_id_t city);
+static void city_trie_remove(struct flight_engine *fe, city_id_t city);
+static void city_trie_destroy(struct city_trie *node);
+
+static void seat_map_create(const struct flight_engine *fe, struct flight *f);
+static void seat_map_destroy(struct flight *f);
+static int  seat_map_taken(const struct flight *f);
+static int  seat_map_take_first(struct flight *f);
+static int  seat_map_give_back_last(struct flight *f);
+static int  seat_map_find_block(const struct flight *f, int seats);
+static void seat_map_set(struct flight *f, int first, int seats, bool taken);
+
+static void snap_publish(struct flight_engine *fe, city_id_t city, const struct flight_schedule *fs);
+static void snap_release(struct snap_ref *r, int height);
+
+
+/****************************************************************
+ * Creates an engine with room for schedules schedules.  Seat   *
+ * maps are kept for every flight when seat_maps is true.       *
+ * Returns NULL if the memory cannot be allocated.              *
+ ****************************************************************/
+struct flight_engine *flight_engine_create(long schedules, bool seat_maps)
+{
+  struct flight_engine *fe = calloc(1, sizeof(struct flight_engine));
+
+  if (fe == NULL || schedules <= 0) {
+    free(fe);
+    return NULL;
+  }
+
+  // The array is allocated once on the heap rather than as a variable
+  // length array so that large numbers of schedules do not overflow the
+  // stack.  It lives as long as the engine so its memory and values are
+  // stable.
+  fe->schedules = malloc(sizeof(struct flight_schedule) * schedules);
+  fe->count = schedules;
+  fe->seat_maps = seat_maps;
+  if (fe->schedules == NULL || !time_index_initialize(fe)) {
+    free(fe->schedules);
+    free(fe);
+    return NULL;
+  }
+
+  // Initialize the lists of free and active schedules using the
+  // elements of the schedules array
+  flight_schedule_initialize(fe);
+
+  // DEFENSIVE PROGRAMMING:  Write code that avoids bad things from happening.
+  //  When possible, if we know that some particular thing should have happened
+  //  we think of that as an assertion and write code to test them.
+  // Use the assert function (CPAMA p749) to be sure the initilization has set
+  // the free list to a non-null value and the the active list is a null value.
+  assert(fe->schedules_free != NULL && fe->schedules_active == NULL);
+  return fe;
+}
+
+/****************************************************************
+ * Frees an engine and everything it holds                      *
+ ****************************************************************/
+void flight_engine_destroy(struct flight_engine *fe)
+{
+  if (fe == NULL) {
+    return;
+  }
+  for (struct flight_schedule *fs = fe->schedules_active; fs != NULL; fs = fs->next) {
+    for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+      seat_map_destroy(&fs->flights[i]);
+    }
+  }
+  for (int d = 0; d < SCHEDULE_DAYS; d++) {
+    free(fe->time_index.days[d]);
+  }
+  free(fe->time_index.links);
+  snap_release(fe->snap_root, fe->snap_height);
+  city_trie_destroy(fe->trie_root);
+  free(fe->intern.names);
+  free(fe->intern.schedules);
+  free(fe->intern.table);
+  free(fe->schedules);
+  free(fe);
+}
+
+#ifdef FLIGHT_STATS
+/****************************************************************
+ * Returns what the engine has measured so far                  *
+ ****************************************************************/
+const struct flight_stats *flight_engine_stats(const struct flight_engine *fe)
+{
+  return &fe->stats;
+}
+#endif
+
+
+/****************************************************************
+ * Resets a flight schedule                                     *
+ ****************************************************************/
+static void flight_schedule_reset(struct flight_schedule *fs) {
+    fs->destination = CITY_ID_NULL;
+    for (int i=0; i<MAX_FLIGHTS_PER_CITY; i++) {
+      fs->flights[i].time = TIME_NULL;
+      fs->flights[i].available = 0;
+      fs->flights[i].capacity = 0;
+      fs->flights[i].seat_map = NULL;
+    }
+    fs->next = NULL;
+    fs->prev = NULL;
+}
+
+/******************************************************************
+* Initializes the flight_schedule array that will hold any flight *
+* schedules created by the user.                                  *
+ *****************************************************************/
+
+static void flight_schedule_initialize(struct flight_engine *fe)
+{
+  struct flight_schedule *array = fe->schedules;
+  long n = fe->count;
+
+  fe->schedules_active = NULL;
+  fe->schedules_free = NULL;
+
+  // takes care of empty array case
+  if (n==0) return;
+
+  // Loop through the Array connecting them
+  // as a linear doubly linked list
+  for (int i = 0; i< n-1; i++) {
+
+    flight_schedule_reset(&array[i]);
+    array[i].next = &array[i+1];
+    array[i+1].prev = &array[i];
+
+  }
+
+  // Takes care of last node.
+  flight_schedule_reset(&array[n-1]); // reset clears all fields
+  array[n-1].next = NULL;
+  array[n-1].prev = (n > 1) ? &array[n-2] : NULL;
+  fe->schedules_free = &array[0];
+  STATS_FREE_INIT(fe, n);
+
+}
+
+static void flight_schedule_sort_flights_by_time(struct flight_engine *fe, struct flight_schedule *fs)
+{
+  STATS_START(start);
+  qsort(fs->flights, MAX_FLIGHTS_PER_CITY, sizeof(struct flight),
+	flight_compare_time);
+  STATS_STOP(fe->stats.op[STATS_OP_SORT], start);
+  (void)fe;
+}
+
+static int flight_compare_time(const void *a, const void *b)
+{
+  const struct flight *af = a;
+  const struct flight *bf = b;
+
+  return (af->time - bf->time);
+}
+
+
+/****************************************************************
+ * Initializes the departure time index for the schedules of    *
+ * fe.  The clock starts at the beginning of day 0 with no live *
+ * days.  Returns false if the links cannot be allocated.       *
+ ****************************************************************/
+static bool time_index_initialize(struct flight_engine *fe)
+{
+  struct time_index *ti = &fe->time_index;
+
+  ti->links = malloc(sizeof(struct time_link) * fe->count * MAX_FLIGHTS_PER_CITY);
+  if (ti->links == NULL) {
+    return false;
+  }
+  ti->now = TIME_MIN;
+  for (int d = 0; d < SCHEDULE_DAYS; d++) {
+    ti->days[d] = NULL;
+  }
+  ti->live_days = 0;
+  return true;
+}
+
+/****************************************************************
+ * Returns true if a flight can depart at time: not before the  *
+ * clock and not after the last day of the wheel                *
+ ****************************************************************/
+bool flight_time_valid(const struct flight_engine *fe, flight_time_t time)
+{
+  flight_time_t now = fe->time_index.now;
+
+  return time >= now && TIME_DAY(time) < TIME_DAY(now) + SCHEDULE_DAYS;
+}
+
+/****************************************************************
+ * Returns the time of the clock                                *
+ ****************************************************************/
+flight_time_t flight_clock(const struct flight_engine *fe)
+{
+  return fe->time_index.now;
+}
+
+/****************************************************************
+ * Returns the departures of day or NULL if it has none         *
+ ****************************************************************/
+static struct time_day *time_index_day(const struct flight_engine *fe, int day)
+{
+  struct time_day *d = fe->time_index.days[day % SCHEDULE_DAYS];
+
+  return (d != NULL && d->day == day) ? d : NULL;
+}
+
+/****************************************************************
+ * Returns the departures of day, allocating them if it has     *
+ * none yet.  day must be on the wheel.                         *
+ ****************************************************************/
+static struct time_day *time_index_day_open(struct flight_engine *fe, int day)
+{
+  struct time_index *ti = &fe->time_index;
+  struct time_day *d = time_index_day(fe, day);
+
+  if (d == NULL) {
+    assert(ti->days[day % SCHEDULE_DAYS] == NULL);
+    d = malloc(sizeof(struct time_day));
+    if (d == NULL) {
+      printf("ERROR: Unable to allocate the time index.\n");
+      exit(EXIT_FAILURE);
+    }
+    d->day = day;
+    for (int t = 0; t < TIME_SLOTS; t++) {
+      d->head[t] = FLIGHT_HANDLE_NULL;
+    }
+    memset(d->occupied, 0, sizeof(d->occupied));
+    memset(d->hour_seats, 0, sizeof(d->hour_seats));
+    ti->days[day % SCHEDULE_DAYS] = d;
+    ti->live_days |= (uint64_t)1 << (day % SCHEDULE_DAYS);
+  }
+  return d;
+}
+
+/****************************************************************
+ * Returns the first live day in [day, last] or -1 if there is  *
+ * none.  The day wheel is rotated so bit k is day + k and the  *
+ * days before day that wrapped around are masked off.          *
+ ****************************************************************/
+static int time_index_day_next(const struct flight_engine *fe, int day, int last)
+{
+  const struct time_index *ti = &fe->time_index;
+  int skip = day - TIME_DAY(ti->now);
+  int r = day % SCHEDULE_DAYS;
+  uint64_t live = ti->live_days;
+
+  if (skip >= SCHEDULE_DAYS || day > last) {
+    return -1;
+  }
+  if (r != 0) {
+    live = (live >> r) | (live << (SCHEDULE_DAYS - r));
+  }
+  if (skip > 0) {
+    live &= ~(uint64_t)0 >> skip;
+  }
+  if (live == 0) {
+    return -1;
+  }
+
+  int next = day + __builtin_ctzll(live);
+  return (next <= last) ? next : -1;
+}
+
+/****************************************************************
+ * Returns the first minute at or after minute of day d that    *
+ * has a departure or -1 if there is none.  Empty minutes are   *
+ * skipped 64 at a time using the occupancy bitmap.             *
+ ****************************************************************/
+static int time_day_next_minute(const struct time_day *d, int minute)
+{
+  int w = minute / 64;
+  uint64_t bits = d->occupied[w] & (~(uint64_t)0 << (minute % 64));
+
+  while (bits == 0) {
+    if (++w >= TIME_INDEX_WORDS) {
+      return -1;
+    }
+    bits = d->occupied[w];
+  }
+  return w * 64 + __builtin_ctzll(bits);
+}
+
+/****************************************************************
+ * Pushes flight handle h onto the bucket of time               *
+ ****************************************************************/
+static void time_index_link(struct flight_engine *fe, int h, flight_time_t time)
+{
+  struct time_index *ti = &fe->time_index;
+  struct time_day *d = time_index_day_open(fe, TIME_DAY(time));
+  int slot = TIME_MINUTE(time);
+
+  ti->links[h].prev = FLIGHT_HANDLE_NULL;
+  ti->links[h].next = d->head[slot];
+  if (d->head[slot] != FLIGHT_HANDLE_NULL) {
+    ti->links[d->head[slot]].prev = h;
+  }
+  d->head[slot] = h;
+  d->occupied[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+/****************************************************************
+ * Unlinks flight handle h from the bucket of time              *
+ ****************************************************************/
+static void time_index_unlink(struct flight_engine *fe, int h, flight_time_t time)
+{
+  struct time_index *ti = &fe->time_index;
+  struct time_day *d = time_index_day(fe, TIME_DAY(time));
+  int slot = TIME_MINUTE(time);
+  struct time_link *l = &ti->links[h];
+
+  if (l->prev == FLIGHT_HANDLE_NULL) {
+    d->head[slot] = l->next;
+  } else {
+    ti->links[l->prev].next = l->next;
+  }
+  if (l->next != FLIGHT_HANDLE_NULL) {
+    ti->links[l->next].prev = l->prev;
+  }
+  if (d->head[slot] == FLIGHT_HANDLE_NULL) {
+    d->occupied[slot / 64] &= ~((uint64_t)1 << (slot % 64));
+  }
+}
+
+/****************************************************************
+ * Adds all the flights of fs to the time index.  Must be       *
+ * called after every change to the times of fs's flights.      *
+ ****************************************************************/
+static void time_index_attach(struct flight_engine *fe, struct flight_schedule *fs)
+{
+  int base = (fs - fe->schedules) * MAX_FLIGHTS_PER_CITY;
+
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+    if (fs->flights[i].time != TIME_NULL) {
+      time_index_link(fe, base + i, fs->flights[i].time);
+      time_index_seats_changed(fe, fs->flights[i].time, fs->flights[i].available);
+    }
+  }
+}
+
+/****************************************************************
+ * Removes all the flights of fs from the time index.  Must be  *
+ * called before any change to the times of fs's flights.       *
+ ****************************************************************/
+static void time_index_detach(struct flight_engine *fe, struct flight_schedule *fs)
+{
+  int base = (fs - fe->schedules) * MAX_FLIGHTS_PER_CITY;
+
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+    if (fs->flights[i].time != TIME_NULL) {
+      time_index_unlink(fe, base + i, fs->flights[i].time);
+      time_index_seats_changed(fe, fs->flights[i].time, -fs->flights[i].available);
+    }
+  }
+}
+
+/****************************************************************
+ * Accounts for delta seats becoming available on a flight      *
+ * departing at time                                            *
+ ****************************************************************/
+static void time_index_seats_changed(struct flight_engine *fe, flight_time_t time, int delta)
+{
+  time_index_day(fe, TIME_DAY(time))->hour_seats[TIME_MINUTE(time) / 60] += delta;
+}
+
+/****************************************************************
+ * Returns the first time in [from, to] that has at least one   *
+ * departure or TIME_NULL if there is none.  Days without       *
+ * departures are skipped with the day wheel and empty minutes  *
+ * with the occupancy bitmap of the day.                        *
+ ****************************************************************/
+static flight_time_t time_index_next(const struct flight_engine *fe, flight_time_t from, flight_time_t to)
+{
+  if (from > to) {
+    return TIME_NULL;
+  }
+
+  for (int day = time_index_day_next(fe, TIME_DAY(from), TIME_DAY(to)); day >= 0;
+       day = time_index_day_next(fe, day + 1, TIME_DAY(to))) {
+    int minute = (day == TIME_DAY(from)) ? TIME_MINUTE(from) : 0;
+
+    minute = time_day_next_minute(time_index_day(fe, day), minute);
+    if (minute >= 0) {
+      flight_time_t next = day * MINUTES_PER_DAY + minute;
+      return (next <= to) ? next : TIME_NULL;
+    }
+  }
+  return TIME_NULL;
+}
+
+/****************************************************************
+ * Returns the first time in [from, to] that has a departure in *
+ * an hour with at least seats available seats in total, or     *
+ * TIME_NULL if there is none.  No flight of an hour with fewer *
+ * can have seats available so the whole hour is skipped.       *
+ ****************************************************************/
+static flight_time_t time_index_next_seats(const struct flight_engine *fe, flight_time_t from,
+                                           flight_time_t to, int seats)
+{
+  flight_time_t t = time_index_next(fe, from, to);
+
+  while (t != TIME_NULL &&
+         time_index_day(fe, TIME_DAY(t))->hour_seats[TIME_MINUTE(t) / 60] < seats) {
+    t = time_index_next(fe, t - t % 60 + 60, to);
+  }
+  return t;
+}
+
+/****************************************************************
+ * Moves the clock forward to time to.  Every flight departing  *
+ * before it is removed from its schedule, giving its slot back *
+ * for new flights, and the days that are over are freed in one *
+ * go.  Each departed flight is visited once so the cost is     *
+ * constant per flight plus a scan of the occupancy bitmaps.    *
+ * Returns the number of flights that departed.                 *
+ ****************************************************************/
+static int time_index_advance(struct flight_engine *fe, flight_time_t to)
+{
+  struct time_index *ti = &fe->time_index;
+  int departed = 0;
+
+  if (to <= ti->now) {
+    return 0;
+  }
+
+  for (int day = time_index_day_next(fe, TIME_DAY(ti->now), TIME_DAY(to)); day >= 0;
+       day = time_index_day_next(fe, day + 1, TIME_DAY(to))) {
+    struct time_day *d = time_index_day(fe, day);
+    int end = (day == TIME_DAY(to)) ? TIME_MINUTE(to) : MINUTES_PER_DAY;
+
+    // a retired flight's schedule is sorted and attached again so the
+    // bitmap is read afresh for each flight
+    for (int minute = time_day_next_minute(d, 0); minute >= 0 && minute < end;
+         minute = time_day_next_minute(d, minute)) {
+      int h = d->head[minute];
+
+      flight_schedule_clear_flight(fe, &fe->schedules[h / MAX_FLIGHTS_PER_CITY],
+                                   h % MAX_FLIGHTS_PER_CITY);
+      departed++;
+    }
+
+    if (day < TIME_DAY(to)) {
+      // nothing departs on this day any more
+      ti->days[day % SCHEDULE_DAYS] = NULL;
+      ti->live_days &= ~((uint64_t)1 << (day % SCHEDULE_DAYS));
+      free(d);
+    }
+  }
+  ti->now = to;
+  return departed;
+}
+
+/****************************************************************
+ * Moves the clock forward to time to, removing the flights     *
+ * that departed before it.  Returns how many departed.         *
+ ****************************************************************/
+int flight_clock_advance(struct flight_engine *fe, flight_time_t to)
+{
+  return time_index_advance(fe, to);
+}
+
+/****************************************************************
+ * Starts it on the flights departing between from and to with  *
+ * at least seats available seats                               *
+ ****************************************************************/
+void flight_departures_begin(struct flight_engine *fe, struct flight_departures *it,
+                             flight_time_t from, flight_time_t to, int seats)
+{
+  it->fe = fe;
+  it->to = to;
+  it->seats = seats;
+  it->walked = 0;
+  it->t = time_index_next_seats(fe, from, to, seats);
+  it->h = (it->t != TIME_NULL)
+    ? time_index_day(fe, TIME_DAY(it->t))->head[TIME_MINUTE(it->t)] : FLIGHT_HANDLE_NULL;
+  if (it->t == TIME_NULL) {
+    STATS_RECORD(fe->stats.walk[STATS_WALK_DEPARTURES], 0);
+  }
+}
+
+/****************************************************************
+ * Returns the next flight of it and sets *city to its          *
+ * destination, or returns NULL once there are no more.  The    *
+ * time index is walked minute by minute, jumping over empty    *
+ * minutes and over hours without enough seats in total, so the *
+ * cost does not depend on the number of schedules.  Every      *
+ * flight of the other hours is checked though: when most       *
+ * flights in range are short of seats the cost grows with the  *
+ * number of flights departing in range, not with the number    *
+ * returned.                                                    *
+ ****************************************************************/
+const struct flight *flight_departures_next(struct flight_departures *it, city_id_t *city)
+{
+  struct flight_engine *fe = it->fe;
+
+  while (it->t != TIME_NULL) {
+    while (it->h != FLIGHT_HANDLE_NULL) {
+      struct flight_schedule *fs = &fe->schedules[it->h / MAX_FLIGHTS_PER_CITY];
+      struct flight *f = &fs->flights[it->h % MAX_FLIGHTS_PER_CITY];
+
+      it->h = fe->time_index.links[it->h].next;
+      it->walked++;
+      if (f->available >= it->seats) {
+        *city = fs->destination;
+        return f;
+      }
+    }
+    it->t = (it->t < it->to) ? time_index_next_seats(fe, it->t + 1, it->to, it->seats) : TIME_NULL;
+    if (it->t != TIME_NULL) {
+      it->h = time_index_day(fe, TIME_DAY(it->t))->head[TIME_MINUTE(it->t)];
+    } else {
+      STATS_RECORD(fe->stats.walk[STATS_WALK_DEPARTURES], it->walked);
+    }
+  }
+  return NULL;
+}
+
+/****************************************************************
+ * Returns the total number of available seats on the flights   *
+ * departing in an hour of the clock's day                      *
+ ****************************************************************/
+long flight_hour_seats(const struct flight_engine *fe, int hour)
+{
+  struct time_day *d = time_index_day(fe, TIME_DAY(fe->time_index.now));
+
+  return (d != NULL) ? d->hour_seats[hour] : 0;
+}
+
+
+static struct flight_schedule * flight_schedule_allocate(struct flight_engine *fe) {
+
+  struct flight_schedule *fs = fe->schedules_free; // pointer to be used while dealing with the flight_schedule list. Pointer points to the address of the free list.
+
+  if (fs == NULL) { // test case: if the free list is NULL
+
+    return NULL;  // return NULL
+
+  }
+
+  struct flight_schedule *fst = fe->schedules_free->next; // a temeporary pointer to hold the place for the next node of the free list.
+
+  if (fe->schedules_active == NULL) {  // if the active list is equal to NULL
+
+    fs->next = NULL; // assign the free list's next node to NULL.
+    fe->schedules_active = fs; // assigned the active list to the pointer fs.
+
+    }
+
+  else  { // if the active list is not NULL.
+
+    fs->next = fe->schedules_active; // then the next node of the fs pointer is going to point to the active list
+    fe->schedules_active->prev = fs; // the previous node of the active list is also going to point to the fs pointer.
+    fe->schedules_active = fs; // assigned the address of the node of the active list to the the pointer.
+
+    }
+
+    fe->schedules_free = fst;
+    STATS_FREE(fe, -1);
+
+  if (fe->schedules_free != NULL) {  // if the free list does not equal NULL
+
+    fe->schedules_free->prev = NULL;  // the previous node of the free list is going to be NULL.
+
+    }
+
+  return fe->schedules_active;  // return the active list
+
+}
+
+
+/****************************************************************
+ * Takes a schedule off the free list for city, which must not  *
+ * have one yet.  Returns NULL if there are no free schedules.  *
+ ****************************************************************/
+static struct flight_schedule * flight_schedule_open(struct flight_engine *fe, city_id_t city) {
+
+  struct flight_schedule *p = flight_schedule_allocate(fe);
+
+  if (p != NULL) {
+    p->destination = city;  // set the destination city
+    fe->intern.schedules[city] = p;  // the city's schedule is now p
+    city_trie_insert(fe, city);  // make the name searchable
+    snap_publish(fe, city, p);
+  }
+  return p;
+
+}
+
+
+static void flight_schedule_free(struct flight_engine *fe, struct flight_schedule *fs) {
+
+  if (fs->prev == NULL) {  // if the previous node of fs is equal to NULL
+
+    if (fs->next == NULL) {  // if the next node of fs is equal to NULL
+
+      fe->schedules_active = NULL;  // then the active list is equal to NULL
+
+    }
+
+    else {
+
+      fe->schedules_active = fs->next;  // else: if next node of fs is not NULL then the active list is equal to the next node of fs.
+      fs->next->prev = NULL;
+
+    }
+
+
+  }
+
+  else {  //else: if the previous node of fs is not equal to NULL.
+
+    if (fs->next == NULL) {  // if next node of fs is equal to NULL
+
+      fs->prev->next = NULL;  // then the previous node of the next node of fs is equal to NULL
+
+    }
+
+    else {  // if the next node of fs is not equal to NULL.
+
+      fs->prev->next = fs->next;  // then the previous node of the next node of fs jumps to the next node of fs
+      fs->next->prev = fs->prev;  // and the next node of the previous node of fs is equal to the previous node of fs.
+
+    }
+  }
+
+
+  flight_schedule_reset(fs); // reset the node
+
+  if (fe->schedules_free == NULL) {  // if the free list is equal to NULL
+
+    fe->schedules_free = fs;  // then the free list is equal to the fs node.
+
+  }
+
+  else {  // else: if the free list is not equal to NULL.
+
+    fe->schedules_free->prev = fs; // the previous node of the free list is equal to fs
+    fs->next = fe->schedules_free;  // next node of fs is equal to the free list
+    fe->schedules_free = fs;  // the free list is equal to fs
+
+  }
+  STATS_FREE(fe, 1);
+
+}
+
+
+static struct flight_schedule * flight_schedule_find(struct flight_engine *fe, city_id_t city) {
+
+  // every interned city has a slot in the schedules array so finding a
+  // schedule is a single index rather than a walk of the active list
+  STATS_START(start);
+  struct flight_schedule *fs = NULL;
+
+  if (city < fe->intern.count) {
+
+    fs = fe->intern.schedules[city];
+
+  }
+
+  STATS_STOP(fe->stats.op[STATS_OP_FIND], start);
+  return fs;
+
+}
+
+
+/****************************************************************
+ * Empties flight slot i of fs so it can hold a new flight.     *
+ * The empty slot sorts to the front of the schedule.           *
+ ****************************************************************/
+static void flight_schedule_clear_flight(struct flight_engine *fe, struct flight_schedule *fs, int i)
+{
+  time_index_detach(fe, fs); // flights move while sorting so leave the time index
+  seat_map_destroy(&fs->flights[i]);
+  fs->flights[i].time = TIME_NULL;
+  fs->flights[i].capacity = 0;
+  fs->flights[i].available = 0;
+  flight_schedule_sort_flights_by_time(fe, fs);
+  time_index_attach(fe, fs);
+  snap_publish(fe, fs->destination, fs);
+}
+
+
+/****************************************************************
+ * Returns true if city has a schedule                          *
+ ****************************************************************/
+bool flight_city_active(struct flight_engine *fe, city_id_t city)
+{
+  return flight_schedule_find(fe, city) != NULL;
+}
+
+/****************************************************************
+ * Gives city an empty schedule                                 *
+ ****************************************************************/
+enum flight_status flight_city_add(struct flight_engine *fe, city_id_t city)
+{
+  if (flight_schedule_find(fe, city) != NULL) {
+    return FLIGHT_CITY_EXISTS;
+  }
+  if (flight_schedule_open(fe, city) == NULL) {
+    return FLIGHT_NO_FREE_SCHEDULE;
+  }
+  return FLIGHT_OK;
+}
+
+/****************************************************************
+ * Removes the schedule of city and all its flights             *
+ ****************************************************************/
+enum flight_status flight_city_remove(struct flight_engine *fe, city_id_t city)
+{
+  struct flight_schedule *fs = flight_schedule_find(fe, city);
+
+  if (fs == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+
+  time_index_detach(fe, fs);     // take its flights out of the time index
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+    seat_map_destroy(&fs->flights[i]);
+  }
+  city_trie_remove(fe, city);  // and its name out of the trie
+  snap_publish(fe, city, NULL);
+  fe->intern.schedules[city] = NULL;
+  flight_schedule_free(fe, fs);  // give the schedule back to the free list
+  return FLIGHT_OK;
+}
+
+/****************************************************************
+ * Returns the flights of city in time order and sets *count to *
+ * how many there are, or returns NULL if city has no schedule  *
+ ****************************************************************/
+const struct flight *flight_city_flights(struct flight_engine *fe, city_id_t city, int *count)
+{
+  struct flight_schedule *fs = flight_schedule_find(fe, city);
+  int first = 0;
+
+  if (fs == NULL) {
+    return NULL;
+  }
+  // empty slots sort to the front
+  while (first < MAX_FLIGHTS_PER_CITY && fs->flights[first].time == TIME_NULL) {
+    first++;
+  }
+  *count = MAX_FLIGHTS_PER_CITY - first;
+  return &fs->flights[first];
+}
+
+/****************************************************************
+ * Starts it on the cities that have a schedule                 *
+ ****************************************************************/
+void flight_cities_begin(struct flight_engine *fe, struct flight_cities *it)
+{
+  it->fe = fe;
+  it->next = fe->schedules_active;
+  it->walked = 0;
+}
+
+/****************************************************************
+ * Returns the next city of it or CITY_ID_NULL once there are   *
+ * no more                                                      *
+ ****************************************************************/
+city_id_t flight_cities_next(struct flight_cities *it)
+{
+  const struct flight_schedule *fs = it->next;
+
+  if (fs == NULL) {
+    STATS_RECORD(it->fe->stats.walk[STATS_WALK_ACTIVE], it->walked);
+    return CITY_ID_NULL;
+  }
+  it->next = fs->next;
+  it->walked++;
+  return fs->destination;
+}
+
+
+/****************************************************************
+ * Returns true if a flight of fe can have capacity seats.      *
+ * With seat maps the capacity is bounded so that one command   *
+ * cannot make the engine allocate any amount of memory.        *
+ ****************************************************************/
+static bool flight_capacity_valid(const struct flight_engine *fe, int capacity)
+{
+  return capacity > 0 && (!fe->seat_maps || capacity <= SEAT_MAP_MAX_CAPACITY);
+}
+
+/****************************************************************
+ * Adds a flight to city departing at time with capacity seats. *
+ * The new flight goes in the empty slot at the front of the    *
+ * schedule, which is then sorted by time again.                *
+ ****************************************************************/
+enum flight_status flight_add(struct flight_engine *fe, city_id_t city,
+                              flight_time_t time, int capacity)
+{
+  struct flight_schedule *point = flight_schedule_find(fe, city);
+
+  if (!flight_capacity_valid(fe, capacity)) {
+    return FLIGHT_CAPACITY_BAD;
+  }
+  if (time == TIME_NULL || !flight_time_valid(fe, time)) {
+    return FLIGHT_TIME_BAD;
+  }
+  if (point == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+  if (point->flights[0].time != TIME_NULL) {  // no empty slot left
+    return FLIGHT_MAX_FLIGHTS;
+  }
+
+  time_index_detach(fe, point); // flights move while sorting so leave the time index
+  point->flights[0].time = time;     // add a time for the given city
+  point->flights[0].capacity = capacity;  // add a capacity for given city
+  point->flights[0].available = capacity; // arrange the availability of a given city's flight
+  seat_map_create(fe, &point->flights[0]);
+  flight_schedule_sort_flights_by_time(fe, point); // sorts the flights by given times of a certain city.
+  time_index_attach(fe, point);
+  snap_publish(fe, city, point);
+  return FLIGHT_OK;
+}
+
+/****************************************************************
+ * Removes the flight of city departing at time                 *
+ ****************************************************************/
+enum flight_status flight_remove(struct flight_engine *fe, city_id_t city, flight_time_t time)
+{
+  struct flight_schedule *point = flight_schedule_find(fe, city);
+
+  if (point == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY
+
+    if (point->flights[i].time == time) {  // if the time for the given city is equal to the time.
+
+      flight_schedule_clear_flight(fe, point, i);  // give the slot back to the schedule
+      return FLIGHT_OK;
+
+    }
+  }
+  return FLIGHT_NO_FLIGHT;
+}
+
+/****************************************************************
+ * Books a seat on the first flight of city departing at time   *
+ * or later that has one and sets *booked to it                 *
+ ****************************************************************/
+enum flight_status flight_book(struct flight_engine *fe, city_id_t city,
+                               flight_time_t time, const struct flight **booked)
+{
+  struct flight_schedule *seat = flight_schedule_find(fe, city);
+
+  if (seat == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY
+
+    int timeClose = (time - seat->flights[i].time);  // initialized timeClose variable to understand which time is the closest.
+
+    if (timeClose <= 0) {  // if the variable was less than or equal to zero
+
+      if (seat->flights[i].available > 0) { // and if there are available seats in the flight
+
+        seat->flights[i].available--;  // decrement available seats at the flight
+        seat_map_take_first(&seat->flights[i]);
+        time_index_seats_changed(fe, seat->flights[i].time, -1);
+        snap_publish(fe, city, seat);
+        *booked = &seat->flights[i];
+        return FLIGHT_OK;
+
+      }
+    }
+  }
+  return FLIGHT_NO_SEATS;
+}
+
+/****************************************************************
+ * Gives back a seat of the flight of city departing at time    *
+ ****************************************************************/
+enum flight_status flight_unbook(struct flight_engine *fe, city_id_t city, flight_time_t time)
+{
+  struct flight_schedule *fs = flight_schedule_find(fe, city);
+
+  if (fs == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {  // for loop from 0 to MAX_FLIGHTS_PER_CITY
+
+    if (time == fs->flights[i].time) {  // if the time was equal to the flight
+
+      if (fs->flights[i].capacity > fs->flights[i].available) { // and if a seat of the flight is taken
+
+        fs->flights[i].available++;  // increment available seats at the flight
+        seat_map_give_back_last(&fs->flights[i]);
+        time_index_seats_changed(fe, fs->flights[i].time, 1);
+        snap_publish(fe, city, fs);
+        return FLIGHT_OK;
+
+      }
+      return FLIGHT_ALL_SEATS_EMPTY;
+    }
+  }
+  return FLIGHT_NO_FLIGHT;
+}
+
+
+/****************************************************************
+ * Allocates a trie node whose edge label is the len first      *
+ * characters of label                                          *
+ ****************************************************************/
+static struct city_trie *city_trie_node(const char *label, int len)
+{
+  struct city_trie *node = malloc(sizeof(struct city_trie) + len);
+
+  if (node == NULL) {
+    printf("ERROR: Unable to allocate a city trie node.\n");
+    exit(EXIT_FAILURE);
+  }
+  node->city = CITY_ID_NULL;
+  node->child = NULL;
+  node->sibling = NULL;
+  node->len = len;
+  memcpy(node->label, label, len);
+  return node;
+}
+
+/****************************************************************
+ * Returns the link of parent's sibling list at which a child   *
+ * starting with letter c is or would be stored                 *
+ ****************************************************************/
+static struct city_trie **city_trie_slot(struct city_trie *parent, char c)
+{
+  struct city_trie **link = &parent->child;
+
+  while (*link != NULL && (*link)->label[0] < c) {
+    link = &(*link)->sibling;
+  }
+  return link;
+}
+
+/****************************************************************
+ * Returns the length of the common prefix of a node's label    *
+ * and the string s                                             *
+ ****************************************************************/
+static int city_trie_common(const struct city_trie *node, const char *s)
+{
+  int i = 0;
+
+  while (i < node->len && s[i] == node->label[i]) {
+    i++;
+  }
+  return i;
+}
+
+/****************************************************************
+ * Adds the name of city to the trie.  An edge that only partly *
+ * matches the name is split in two.                            *
+ ****************************************************************/
+static void city_trie_insert(struct flight_engine *fe, city_id_t city)
+{
+  const char *name = flight_city_name(fe, city);
+
+  if (fe->trie_root == NULL) {
+    fe->trie_root = city_trie_node("", 0);
+  }
+
+  struct city_trie *node = fe->trie_root;
+
+  while (*name != '\0') {
+    struct city_trie **link = city_trie_slot(node, *name);
+    struct city_trie *c = *link;
+
+    if (c == NULL || c->label[0] != *name) {
+      // no edge starts with this letter: hang the rest of the name here
+      struct city_trie *leaf = city_trie_node(name, strlen(name));
+      leaf->city = city;
+      leaf->sibling = c;
+      *link = leaf;
+      return;
+    }
+
+    int common = city_trie_common(c, name);
+    if (common < c->len) {
+      // split the edge, the tail keeps c's schedule and children
+      struct city_trie *tail = city_trie_node(c->label + common, c->len - common);
+      tail->city = c->city;
+      tail->child = c->child;
+      c->city = CITY_ID_NULL;
+      c->child = tail;
+      c->len = common;
+    }
+    node = c;
+    name += common;
+  }
+  node->city = city;
+}
+
+/****************************************************************
+ * Removes name from the subtree below parent.  Nodes left with *
+ * no schedule and no children are freed and a node left with  *
+ * a single child is merged with it to keep the trie compact.   *
+ ****************************************************************/
+static void city_trie_remove_below(struct city_trie *parent, const char *name)
+{
+  struct city_trie **link = city_trie_slot(parent, *name);
+  struct city_trie *c = *link;
+
+  if (c == NULL || c->label[0] != *name || city_trie_common(c, name) < c->len) {
+    return;
+  }
+
+  if (name[c->len] == '\0') {
+    c->city = CITY_ID_NULL;
+  } else {
+    city_trie_remove_below(c, name + c->len);
+  }
+
+  if (c->city != CITY_ID_NULL) {
+    return;
+  }
+  if (c->child == NULL) {
+    *link = c->sibling;
+    free(c);
+  } else if (c->child->sibling == NULL) {
+    struct city_trie *only = c->child;
+    struct city_trie *merged = city_trie_node(c->label, c->len + only->len);
+
+    memcpy(merged->label + c->len, only->label, only->len);
+    merged->city = only->city;
+    merged->child = only->child;
+    merged->sibling = c->sibling;
+    *link = merged;
+    free(only);
+    free(c);
+  }
+}
+
+/****************************************************************
+ * Removes the name of city from the trie                       *
+ ****************************************************************/
+static void city_trie_remove(struct flight_engine *fe, city_id_t city)
+{
+  const char *name = flight_city_name(fe, city);
+
+  if (fe->trie_root != NULL && *name != '\0') {
+    city_trie_remove_below(fe->trie_root, name);
+  }
+}
+
+/****************************************************************
+ * Frees node and everything below it                           *
+ ****************************************************************/
+static void city_trie_destroy(struct city_trie *node)
+{
+  while (node != NULL) {
+    struct city_trie *sibling = node->sibling;
+
+    city_trie_destroy(node->child);
+    free(node);
+    node = sibling;
+  }
+}
+
+/****************************************************************
+ * Visits the cities of all the schedules in node's subtree in  *
+ * alphabetical order                                           *
+ ****************************************************************/
+static void city_trie_visit(const struct city_trie *node, flight_city_visit *visit, void *arg)
+{
+  if (node->city != CITY_ID_NULL) {
+    visit(arg, node->city, 0);
+  }
+  for (const struct city_trie *c = node->child; c != NULL; c = c->sibling) {
+    city_trie_visit(c, visit, arg);
+  }
+}
+
+/****************************************************************
+ * Visits the active cities whose name starts with prefix in    *
+ * alphabetical order.  Only the path spelling the prefix and   *
+ * the matching subtree are visited.                            *
+ ****************************************************************/
+void flight_cities_prefix(struct flight_engine *fe, const char *prefix,
+                          flight_city_visit *visit, void *arg)
+{
+  const struct city_trie *node = fe->trie_root;
+  const char *s = prefix;
+
+  if (node == NULL) {
+    return;
+  }
+
+  while (*s != '\0') {
+    struct city_trie *c = *city_trie_slot((struct city_trie *)node, *s);
+
+    if (c == NULL || c->label[0] != *s) {
+      return;
+    }
+    int common = city_trie_common(c, s);
+    if (s[common] != '\0' && common < c->len) {
+      return;  // the prefix leaves the trie in the middle of the edge
+    }
+    node = c;
+    s += common;
+  }
+  city_trie_visit(node, visit, arg);
+}
+
+/****************************************************************
+ * Walks the children of node computing one row of the edit     *
+ * distance table against name per letter.  A branch is cut as *
+ * soon as every entry of its row is over the distance limit.   *
+ ****************************************************************/
+static void city_trie_similar(const struct city_trie *node, const char *name,
+                              int n, const int *prev_row, int max_distance,
+                              flight_city_visit *visit, void *arg)
+{
+  for (const struct city_trie *c = node->child; c != NULL; c = c->sibling) {
+    int row[MAX_CITY_NAME_LEN + 1];
+    bool alive = true;
+
+    memcpy(row, prev_row, sizeof(int) * (n + 1));
+    for (int i = 0; i < c->len && alive; i++) {
+      int diag = row[0];
+
+      row[0]++;
+      alive = row[0] <= max_distance;
+      for (int j = 1; j <= n; j++) {
+        int up = row[j];
+        int best = diag + (name[j-1] != c->label[i]);
+
+        if (up + 1 < best) {
+          best = up + 1;
+        }
+        if (row[j-1] + 1 < best) {
+          best = row[j-1] + 1;
+        }
+        row[j] = best;
+        diag = up;
+        if (best <= max_distance) {
+          alive = true;
+        }
+      }
+    }
+
+    if (!alive) {
+      continue;
+    }
+    if (c->city != CITY_ID_NULL && row[n] <= max_distance) {
+      visit(arg, c->city, row[n]);
+    }
+    city_trie_similar(c, name, n, row, max_distance, visit, arg);
+  }
+}
+
+/****************************************************************
+ * Visits the active cities whose name is within max_distance   *
+ * edits (insertions, deletions or substitutions) of name       *
+ ****************************************************************/
+void flight_cities_similar(struct flight_engine *fe, const char *name,
+                           int max_distance, flight_city_visit *visit, void *arg)
+{
+  int row[MAX_CITY_NAME_LEN + 1];
+  int n = strlen(name);
+
+  if (fe->trie_root == NULL || n > MAX_CITY_NAME_LEN) {
+    return;
+  }
+  for (int j = 0; j <= n; j++) {
+    row[j] = j;
+  }
+  if (fe->trie_root->city != CITY_ID_NULL && n <= max_distance) {
+    visit(arg, fe->trie_root->city, n);
+  }
+  city_trie_similar(fe->trie_root, name, n, row, max_distance, visit, arg);
+}
+
+
+/****************************************************************
+ * FNV-1a hash of a city name                                   *
+ ****************************************************************/
+static uint32_t city_hash(const char *name)
+{
+  uint32_t h = 2166136261u;
+
+  while (*name != '\0') {
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  }
+  return h;
+}
+
+/****************************************************************
+ * Doubles the number of ids the intern table can hold and      *
+ * rehashes the existing ids into a table twice as large        *
+ ****************************************************************/
+static void city_intern_grow(struct flight_engine *fe)
+{
+  struct city_intern *ci = &fe->intern;
+  uint32_t capacity = (ci->capacity == 0) ? CITY_INTERN_MIN_IDS : ci->capacity * 2;
+  uint32_t table_size = capacity * 2;
+  city_t *names = realloc(ci->names, sizeof(city_t) * capacity);
+  struct flight_schedule **schedules =
+    realloc(ci->schedules, sizeof(struct flight_schedule *) * capacity);
+  city_id_t *table = malloc(sizeof(city_id_t) * table_size);
+
+  if (names == NULL || schedules == NULL || table == NULL) {
+    printf("ERROR: Unable to grow the city table.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint32_t i = 0; i < table_size; i++) {
+    table[i] = CITY_ID_NULL;
+  }
+  for (city_id_t id = 0; id < ci->count; id++) {
+    uint32_t h = city_hash(names[id]) & (table_size - 1);
+
+    while (table[h] != CITY_ID_NULL) {
+      h = (h + 1) & (table_size - 1);
+    }
+    table[h] = id;
+  }
+
+  free(ci->table);
+  ci->names = names;
+  ci->schedules = schedules;
+  ci->capacity = capacity;
+  ci->table = table;
+  ci->table_size = table_size;
+}
+
+/****************************************************************
+ * Returns the slot of the hash table holding the id of name or *
+ * the empty slot where it would go.  The table must exist.     *
+ ****************************************************************/
+static uint32_t city_intern_slot(const struct city_intern *ci, const char *name)
+{
+  uint32_t h = city_hash(name) & (ci->table_size - 1);
+
+  while (ci->table[h] != CITY_ID_NULL &&
+         strcmp(ci->names[ci->table[h]], name) != 0) {
+    h = (h + 1) & (ci->table_size - 1);
+  }
+  return h;
+}
+
+/****************************************************************
+ * Returns the id of the city called name, handing out the next *
+ * id if the name has not been seen before.  Names longer than  *
+ * MAX_CITY_NAME_LEN are cut.  Ids are never given back, so     *
+ * names that only need looking up go through flight_city_find. *
+ ****************************************************************/
+city_id_t flight_city_id(struct flight_engine *fe, const char *name)
+{
+  struct city_intern *ci = &fe->intern;
+  city_t cut;
+
+  if (strlen(name) > MAX_CITY_NAME_LEN) {
+    memcpy(cut, name, MAX_CITY_NAME_LEN);
+    cut[MAX_CITY_NAME_LEN] = '\0';
+    name = cut;
+  }
+  if (ci->count == ci->capacity) {
+    city_intern_grow(fe);
+  }
+
+  uint32_t h = city_intern_slot(ci, name);
+  if (ci->table[h] != CITY_ID_NULL) {
+    return ci->table[h];
+  }
+
+  city_id_t id = ci->count++;
+  strcpy(ci->names[id], name);
+  ci->schedules[id] = NULL;
+  ci->table[h] = id;
+  return id;
+}
+
+/****************************************************************
+ * Returns the id of the city called name or CITY_ID_NULL if    *
+ * the name has never been given an id.  Nothing is interned.   *
+ ****************************************************************/
+city_id_t flight_city_find(const struct flight_engine *fe, const char *name)
+{
+  const struct city_intern *ci = &fe->intern;
+  city_t cut;
+
+  if (ci->table_size == 0) {
+    return CITY_ID_NULL;
+  }
+  if (strlen(name) > MAX_CITY_NAME_LEN) {
+    memcpy(cut, name, MAX_CITY_NAME_LEN);
+    cut[MAX_CITY_NAME_LEN] = '\0';
+    name = cut;
+  }
+  return ci->table[city_intern_slot(ci, name)];
+}
+
+/****************************************************************
+ * Returns the name of an interned city                         *
+ ****************************************************************/
+const char *flight_city_name(const struct flight_engine *fe, city_id_t city)
+{
+  return fe->intern.names[city];
+}
+
+
+/****************************************************************
+ * Books a batch of n requests all or nothing.  Each request    *
+ * takes its seats together on the first flight of its city    *
+ * departing at or after the requested time with enough seats   *
+ * left, the same rule a single seat booking follows.  Seats    *
+ * are taken as the batch is walked so requests for the same    *
+ * flight see each other, and are handed back if a later        *
+ * request cannot be booked.  A request must be for at least   *
+ * one seat.  Returns -1 once every request is booked,          *
+ * otherwise the index of the request that failed.              *
+ ****************************************************************/
+int flight_book_batch(struct flight_engine *fe, struct booking_request reqs[], int n)
+{
+  int failed = -1;
+
+  // a request for no seats would give seats back instead of taking
+  // them, so the batch is refused before any seat is touched
+  for (int r = 0; r < n; r++) {
+    reqs[r].slot = -1;
+    reqs[r].booked = TIME_NULL;
+  }
+  for (int r = 0; r < n; r++) {
+    if (reqs[r].seats <= 0) {
+      return r;
+    }
+  }
+
+  for (int r = 0; r < n && failed < 0; r++) {
+    struct flight_schedule *fs = flight_schedule_find(fe, reqs[r].city);
+
+    for (int i = 0; fs != NULL && i < MAX_FLIGHTS_PER_CITY; i++) {
+      struct flight *f = &fs->flights[i];
+
+      if (f->time != TIME_NULL && f->time >= reqs[r].time &&
+          f->available >= reqs[r].seats) {
+        f->available -= reqs[r].seats;
+        reqs[r].slot = i;
+        reqs[r].booked = f->time;
+        break;
+      }
+    }
+    if (reqs[r].slot < 0) {
+      failed = r;
+    }
+  }
+
+  // either give back what was taken or publish it to the time index
+  for (int r = 0; r < n && r != failed; r++) {
+    struct flight_schedule *fs = flight_schedule_find(fe, reqs[r].city);
+    struct flight *f = &fs->flights[reqs[r].slot];
+
+    if (failed >= 0) {
+      f->available += reqs[r].seats;
+    } else {
+      time_index_seats_changed(fe, f->time, -reqs[r].seats);
+      for (int k = 0; k < reqs[r].seats; k++) {
+        seat_map_take_first(f);
+      }
+      snap_publish(fe, reqs[r].city, fs);
+    }
+  }
+  for (int r = 0; r < n && failed < 0; r++) {
+    struct flight *f = &flight_schedule_find(fe, reqs[r].city)->flights[reqs[r].slot];
+    assert(f->seat_map == NULL || seat_map_taken(f) == f->capacity - f->available);
+    (void)f;
+  }
+  return failed;
+}
+
+
+#ifdef FLIGHT_STATS
+/****************************************************************
+ * Reads the cpu's cycle counter.  It is a single instruction   *
+ * on the machines we run on so timing a command costs a few    *
+ * nanoseconds.                                                 *
+ ****************************************************************/
+uint64_t stats_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+  uint64_t v;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+  return v;
+#else
+#error "FLIGHT_STATS needs a cycle counter for this cpu"
+#endif
+}
+
+/****************************************************************
+ * Tracks the number of schedules on the free list              *
+ ****************************************************************/
+static void stats_free_initialize(struct flight_engine *fe, long n)
+{
+  fe->stats.free_depth = n;
+  fe->stats.free_depth_min = n;
+}
+
+static void stats_free_depth(struct flight_engine *fe, long delta)
+{
+  fe->stats.free_depth += delta;
+  if (fe->stats.free_depth < fe->stats.free_depth_min) {
+    fe->stats.free_depth_min = fe->stats.free_depth;
+  }
+}
+#endif
+
+/****************************************************************
+ * Returns the histogram bucket of value                        *
+ ****************************************************************/
+static int stats_bucket(uint64_t value)
+{
+  if (value < STATS_SUB_BUCKETS) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - STATS_SUB_BITS;
+  return (shift + 1) * STATS_SUB_BUCKETS + ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+}
+
+/****************************************************************
+ * Returns the smallest value that falls in bucket b            *
+ ****************************************************************/
+static uint64_t stats_bucket_value(int b)
+{
+  if (b < STATS_SUB_BUCKETS) {
+    return b;
+  }
+  int shift = b / STATS_SUB_BUCKETS - 1;
+  return (uint64_t)(STATS_SUB_BUCKETS + b % STATS_SUB_BUCKETS) << shift;
+}
+
+/****************************************************************
+ * Adds value to histogram h                                    *
+ ****************************************************************/
+void stats_record(struct stats_histogram *h, uint64_t value)
+{
+  h->count++;
+  h->sum += value;
+  if (value > h->max) {
+    h->max = value;
+  }
+  h->buckets[stats_bucket(value)]++;
+}
+
+/****************************************************************
+ * Returns the value below which a fraction q of the values of  *
+ * h fall                                                       *
+ ****************************************************************/
+uint64_t stats_percentile(const struct stats_histogram *h, double q)
+{
+  uint64_t rank = (uint64_t)(q * h->count);
+  uint64_t seen = 0;
+
+  for (int b = 0; b < STATS_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen > rank) {
+      return stats_bucket_value(b);
+    }
+  }
+  return h->max;
+}
+
+
+/****************************************************************
+ * Parses a csv integer field at *p that must end at a ',' or   *
+ * at end.  Returns false if it is not a number or does not    *
+ * fit in an int.                                               *
+ ****************************************************************/
+static bool bulk_int(const char **p, const char *end, int *value)
+{
+  const char *q = *p;
+  bool negative = (q < end && *q == '-');
+  int v = 0;
+
+  if (negative) {
+    q++;
+  }
+  if (q == end || !isdigit((unsigned char)*q)) {
+    return false;
+  }
+  while (q < end && isdigit((unsigned char)*q)) {
+    int digit = *q++ - '0';
+
+    if (v > (INT_MAX - digit) / 10) {
+      return false;
+    }
+    v = v * 10 + digit;
+  }
+  while (q < end && (*q == ' ' || *q == '\r')) {
+    q++;
+  }
+  if (q < end && *q != ',') {
+    return false;
+  }
+  *value = negative ? -v : v;
+  *p = (q < end) ? q + 1 : q;
+  return true;
+}
+
+/****************************************************************
+ * Thread body parsing every line of a chunk into rows.  A city *
+ * name is read the way the command line reads it: leading non  *
+ * letters are skipped and it is cut at MAX_CITY_NAME_LEN       *
+ * characters.                                                  *
+ ****************************************************************/
+static void *bulk_parse(void *arg)
+{
+  struct bulk_chunk *chunk = arg;
+  size_t cap = (chunk->end - chunk->begin) / 16 + 16;
+
+  chunk->rows = malloc(sizeof(struct bulk_row) * cap);
+  chunk->count = 0;
+  chunk->skipped = 0;
+  if (chunk->rows == NULL) {
+    return NULL;
+  }
+
+  for (const char *line = chunk->begin; line < chunk->end; ) {
+    const char *eol = memchr(line, '\n', chunk->end - line);
+    const char *p = line;
+    struct bulk_row row;
+
+    if (eol == NULL) {
+      eol = chunk->end;
+    }
+
+    while (p < eol && !isalpha((unsigned char)*p)) {
+      p++;
+    }
+    row.name = p;
+    while (p < eol && *p != ',') {
+      p++;
+    }
+    row.name_len = p - row.name;
+    if (row.name_len > MAX_CITY_NAME_LEN) {
+      row.name_len = MAX_CITY_NAME_LEN;
+    }
+    p++;
+
+    bool valid = row.name_len > 0 && p < eol
+      && bulk_int(&p, eol, &row.time) && bulk_int(&p, eol, &row.capacity)
+      && bulk_int(&p, eol, &row.available)
+      && flight_time_valid(chunk->fe, row.time) && flight_capacity_valid(chunk->fe, row.capacity)
+      && row.available >= 0 && row.available <= row.capacity;
+
+    if (valid) {
+      if (chunk->count == cap) {
+        cap *= 2;
+        struct bulk_row *rows = realloc(chunk->rows, sizeof(struct bulk_row) * cap);
+        if (rows == NULL) {
+          chunk->skipped++;
+          break;
+        }
+        chunk->rows = rows;
+      }
+      chunk->rows[chunk->count++] = row;
+    } else if (!(chunk->first && line == chunk->begin) && eol > line) {
+      chunk->skipped++;  // the header line and blank lines do not count
+    }
+    line = eol + 1;
+  }
+  return NULL;
+}
+
+/****************************************************************
+ * Loads every flight of the size bytes of csv data of          *
+ * city,time,capacity,available lines in one pass.  The data is *
+ * split at line boundaries and parsed by a thread per chunk,   *
+ * then the rows are grouped by city with a counting sort over  *
+ * the city ids so each schedule is filled and sorted once.     *
+ * Rows follow the rules of flight_add: a city gets a schedule  *
+ * if it has none and rows past MAX_FLIGHTS_PER_CITY flights    *
+ * are skipped.                                                 *
+ ****************************************************************/
+enum flight_status flight_bulk_load(struct flight_engine *fe, const char *data,
+                                    size_t size, struct flight_bulk_result *result)
+{
+  // split the data into chunks that start at line boundaries
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int threads = size / BULK_MIN_CHUNK + 1;
+  if (threads > cpus) {
+    threads = (cpus > 0) ? cpus : 1;
+  }
+  if (threads > BULK_MAX_THREADS) {
+    threads = BULK_MAX_THREADS;
+  }
+
+  struct bulk_chunk chunks[BULK_MAX_THREADS];
+  pthread_t tids[BULK_MAX_THREADS];
+  const char *start = data;
+
+  for (int t = 0; t < threads; t++) {
+    const char *stop = data + size * (t + 1) / threads;
+    const char *nl = (stop < data + size) ? memchr(stop, '\n', data + size - stop) : NULL;
+
+    chunks[t].fe = fe;
+    chunks[t].begin = start;
+    chunks[t].end = (t == threads - 1 || nl == NULL) ? data + size : nl + 1;
+    chunks[t].first = (t == 0);
+    start = chunks[t].end;
+    if (t == 0 || pthread_create(&tids[t], NULL, bulk_parse, &chunks[t]) != 0) {
+      tids[t] = 0;
+    }
+  }
+  bulk_parse(&chunks[0]);
+  for (int t = 1; t < threads; t++) {
+    if (tids[t] != 0) {
+      pthread_join(tids[t], NULL);
+    } else {
+      bulk_parse(&chunks[t]);
+    }
+  }
+
+  // intern the names and count the rows of every city
+  long skipped = 0;
+  size_t total = 0;
+  for (int t = 0; t < threads; t++) {
+    skipped += chunks[t].skipped;
+    for (size_t r = 0; r < chunks[t].count; r++) {
+      city_t name;
+      struct bulk_row *row = &chunks[t].rows[r];
+
+      memcpy(name, row->name, row->name_len);
+      name[row->name_len] = '\0';
+      row->city = flight_city_id(fe, name);
+    }
+    total += chunks[t].count;
+  }
+
+  uint32_t cities = fe->intern.count;
+  uint32_t *first = calloc(cities + 1, sizeof(uint32_t));
+  struct bulk_row **grouped = malloc(sizeof(struct bulk_row *) * (total + 1));
+  if (first == NULL || grouped == NULL) {
+    printf("ERROR: Unable to allocate the bulk load.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (int t = 0; t < threads; t++) {
+    for (size_t r = 0; r < chunks[t].count; r++) {
+      first[chunks[t].rows[r].city + 1]++;
+    }
+  }
+  for (uint32_t c = 0; c < cities; c++) {
+    first[c + 1] += first[c];
+  }
+  for (int t = 0; t < threads; t++) {
+    for (size_t r = 0; r < chunks[t].count; r++) {
+      grouped[first[chunks[t].rows[r].city]++] = &chunks[t].rows[r];
+    }
+  }
+
+  // after the scatter first[c] is where city c's rows end, in file order
+  long loaded = 0;
+  long touched = 0;
+  uint32_t begin = 0;
+  for (city_id_t c = 0; c < cities; c++) {
+    uint32_t end = first[c];
+    if (begin == end) {
+      continue;
+    }
+
+    struct flight_schedule *fs = flight_schedule_find(fe, c);
+    if (fs == NULL && (fs = flight_schedule_open(fe, c)) == NULL) {
+      skipped += end - begin;
+      begin = end;
+      continue;
+    }
+
+    time_index_detach(fe, fs);
+    int slot = 0;
+    for (uint32_t r = begin; r < end; r++) {
+      while (slot < MAX_FLIGHTS_PER_CITY && fs->flights[slot].time != TIME_NULL) {
+        slot++;
+      }
+      if (slot == MAX_FLIGHTS_PER_CITY) {
+        skipped += end - r;
+        break;
+      }
+      fs->flights[slot].time = grouped[r]->time;
+      fs->flights[slot].capacity = grouped[r]->capacity;
+      fs->flights[slot].available = grouped[r]->available;
+      seat_map_create(fe, &fs->flights[slot]);
+      loaded++;
+    }
+    flight_schedule_sort_flights_by_time(fe, fs);
+    time_index_attach(fe, fs);
+    snap_publish(fe, c, fs);
+    touched++;
+    begin = end;
+  }
+
+  result->flights = loaded;
+  result->cities = touched;
+  result->skipped = skipped;
+
+  free(grouped);
+  free(first);
+  for (int t = 0; t < threads; t++) {
+    free(chunks[t].rows);
+  }
+  return FLIGHT_OK;
+}
+
+
+/****************************************************************
+ * Gives flight f a seat map when the engine keeps them.  The   *
+ * seats that are already booked are the lowest numbered ones.  *
+ ****************************************************************/
+static void seat_map_create(const struct flight_engine *fe, struct flight *f)
+{
+  if (!fe->seat_maps) {
+    return;
+  }
+  f->seat_map = calloc(SEAT_WORDS(f->capacity), sizeof(uint64_t));
+  if (f->seat_map == NULL) {
+    printf("ERROR: Unable to allocate a seat map.\n");
+    exit(EXIT_FAILURE);
+  }
+  seat_map_set(f, f->capacity, SEAT_WORDS(f->capacity) * SEAT_WORD_BITS - f->capacity, true);
+  seat_map_set(f, 0, f->capacity - f->available, true);
+}
+
+/****************************************************************
+ * Frees the seat map of flight f if it has one                 *
+ ****************************************************************/
+static void seat_map_destroy(struct flight *f)
+{
+  free(f->seat_map);
+  f->seat_map = NULL;
+}
+
+/****************************************************************
+ * Marks seats seats starting at first as taken or free, whole  *
+ * words at a time                                              *
+ ****************************************************************/
+static void seat_map_set(struct flight *f, int first, int seats, bool taken)
+{
+  while (seats > 0) {
+    int w = first / SEAT_WORD_BITS;
+    int bit = first % SEAT_WORD_BITS;
+    int n = (seats < SEAT_WORD_BITS - bit) ? seats : SEAT_WORD_BITS - bit;
+    uint64_t mask = ((n == SEAT_WORD_BITS) ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1)) << bit;
+
+    if (taken) {
+      f->seat_map[w] |= mask;
+    } else {
+      f->seat_map[w] &= ~mask;
+    }
+    first += n;
+    seats -= n;
+  }
+}
+
+/****************************************************************
+ * Returns the number of taken seats of flight f.  It always    *
+ * equals capacity - available.                                 *
+ ****************************************************************/
+static int seat_map_taken(const struct flight *f)
+{
+  int words = SEAT_WORDS(f->capacity);
+  int taken = 0;
+
+  for (int w = 0; w < words; w++) {
+    taken += __builtin_popcountll(f->seat_map[w]);
+  }
+  return taken - (words * SEAT_WORD_BITS - f->capacity);
+}
+
+/****************************************************************
+ * Takes the lowest numbered free seat of flight f and returns  *
+ * its index, or -1 if f has no seat map or is full             *
+ ****************************************************************/
+static int seat_map_take_first(struct flight *f)
+{
+  if (f->seat_map == NULL) {
+    return -1;
+  }
+  for (int w = 0; w < SEAT_WORDS(f->capacity); w++) {
+    uint64_t free_seats = ~f->seat_map[w];
+
+    if (free_seats != 0) {
+      int bit = __builtin_ctzll(free_seats);
+      f->seat_map[w] |= (uint64_t)1 << bit;
+      return w * SEAT_WORD_BITS + bit;
+    }
+  }
+  return -1;
+}
+
+/****************************************************************
+ * Frees the highest numbered taken seat of flight f and        *
+ * returns its index, or -1 if f has no seat map or is empty    *
+ ****************************************************************/
+static int seat_map_give_back_last(struct flight *f)
+{
+  if (f->seat_map == NULL) {
+    return -1;
+  }
+  for (int w = SEAT_WORDS(f->capacity) - 1; w >= 0; w--) {
+    uint64_t taken = f->seat_map[w];
+    int valid = f->capacity - w * SEAT_WORD_BITS;
+
+    if (valid < SEAT_WORD_BITS) {
+      taken &= ((uint64_t)1 << valid) - 1;  // not the padding bits
+    }
+    if (taken != 0) {
+      int bit = 63 - __builtin_clzll(taken);
+      f->seat_map[w] &= ~((uint64_t)1 << bit);
+      return w * SEAT_WORD_BITS + bit;
+    }
+  }
+  return -1;
+}
+
+/****************************************************************
+ * Returns the index of the first seat of the lowest block of   *
+ * seats adjacent free seats of flight f, or -1 if there is     *
+ * none.  Runs of free seats are found with ctz on whole words  *
+ * so a full or empty word is skipped in one step.              *
+ ****************************************************************/
+static int seat_map_find_block(const struct flight *f, int seats)
+{
+  int words = SEAT_WORDS(f->capacity);
+  int pos = 0;
+
+  while (pos < f->capacity) {
+    // first free seat at or after pos
+    int w = pos / SEAT_WORD_BITS;
+    uint64_t bits = ~f->seat_map[w] & (~(uint64_t)0 << (pos % SEAT_WORD_BITS));
+    while (bits == 0) {
+      if (++w == words) {
+        return -1;
+      }
+      bits = ~f->seat_map[w];
+    }
+    int start = w * SEAT_WORD_BITS + __builtin_ctzll(bits);
+
+    // first taken seat after it, the padding bits end the last run
+    w = start / SEAT_WORD_BITS;
+    bits = f->seat_map[w] & (~(uint64_t)0 << (start % SEAT_WORD_BITS));
+    while (bits == 0 && ++w < words) {
+      bits = f->seat_map[w];
+    }
+    int end = (bits == 0) ? f->capacity : w * SEAT_WORD_BITS + __builtin_ctzll(bits);
+
+    if (end - start >= seats) {
+      return start;
+    }
+    pos = end;
+  }
+  return -1;
+}
+
+/****************************************************************
+ * Finds the flight of city departing at time for the seat map  *
+ * operations                                                   *
+ ****************************************************************/
+static enum flight_status seat_map_flight(struct flight_engine *fe, city_id_t city,
+                                          flight_time_t time, struct flight **f)
+{
+  struct flight_schedule *fs = flight_schedule_find(fe, city);
+
+  if (!fe->seat_maps) {
+    return FLIGHT_SEAT_MAPS_OFF;
+  }
+  if (fs == NULL) {
+    return FLIGHT_CITY_BAD;
+  }
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+    if (fs->flights[i].time == time && time != TIME_NULL) {
+      *f = &fs->flights[i];
+      return FLIGHT_OK;
+    }
+  }
+  return FLIGHT_NO_FLIGHT;
+}
+
+/****************************************************************
+ * Sets *f to the flight of city departing at time so its seat  *
+ * map can be read                                              *
+ ****************************************************************/
+enum flight_status flight_seat_flight(struct flight_engine *fe, city_id_t city,
+                                      flight_time_t time, const struct flight **f)
+{
+  struct flight *found;
+  enum flight_status status = seat_map_flight(fe, city, time, &found);
+
+  if (status == FLIGHT_OK) {
+    *f = found;
+  }
+  return status;
+}
+
+/****************************************************************
+ * Returns true if seat, numbered from 0, of f is taken         *
+ ****************************************************************/
+bool flight_seat_taken(const struct flight *f, int seat)
+{
+  return (f->seat_map[seat / SEAT_WORD_BITS] >> (seat % SEAT_WORD_BITS)) & 1;
+}
+
+/****************************************************************
+ * Books the lowest block of seats adjacent seats on the flight *
+ * of city departing at time and sets *first to its first seat. *
+ * A block of no seats or more than the capacity is never free. *
+ ****************************************************************/
+enum flight_status flight_seats_book_block(struct flight_engine *fe, city_id_t city,
+                                           flight_time_t time, int seats, int *first)
+{
+  struct flight *f;
+  enum flight_status status = seat_map_flight(fe, city, time, &f);
+
+  if (status != FLIGHT_OK) {
+    return status;
+  }
+  if (seats <= 0 || seats > f->capacity) {
+    return FLIGHT_NO_BLOCK;
+  }
+
+  int block = seat_map_find_block(f, seats);
+  if (block < 0) {
+    return FLIGHT_NO_BLOCK;
+  }
+  seat_map_set(f, block, seats, true);
+  f->available -= seats;
+  time_index_seats_changed(fe, f->time, -seats);
+  snap_publish(fe, city, flight_schedule_find(fe, city));
+  assert(seat_map_taken(f) == f->capacity - f->available);
+  *first = block;
+  return FLIGHT_OK;
+}
+
+/****************************************************************
+ * Releases one seat, numbered from 0, of a flight              *
+ ****************************************************************/
+enum flight_status flight_seat_release(struct flight_engine *fe, city_id_t city,
+                                       flight_time_t time, int seat)
+{
+  struct flight *f;
+  enum flight_status status = seat_map_flight(fe, city, time, &f);
+
+  if (status != FLIGHT_OK) {
+    return status;
+  }
+  if (seat < 0 || seat >= f->capacity || !flight_seat_taken(f, seat)) {
+    return FLIGHT_SEAT_BAD;
+  }
+  seat_map_set(f, seat, 1, false);
+  f->available++;
+  time_index_seats_changed(fe, f->time, 1);
+  snap_publish(fe, city, flight_schedule_find(fe, city));
+  return FLIGHT_OK;
+}
+
+/****************************************************************
+ * Releases every seat of a flight                              *
+ ****************************************************************/
+enum flight_status flight_seats_release_all(struct flight_engine *fe, city_id_t city,
+                                            flight_time_t time)
+{
+  struct flight *f;
+  enum flight_status status = seat_map_flight(fe, city, time, &f);
+
+  if (status != FLIGHT_OK) {
+    return status;
+  }
+  seat_map_set(f, 0, f->capacity, false);
+  time_index_seats_changed(fe, f->time, f->capacity - f->available);
+  f->available = f->capacity;
+  snap_publish(fe, city, flight_schedule_find(fe, city));
+  return FLIGHT_OK;
+}
+
+
+/****************************************************************
+ * Adds an owner to a node or image of the snapshot tree        *
+ ****************************************************************/
+static void snap_share(struct snap_ref *r)
+{
+  if (r != NULL) {
+    atomic_fetch_add_explicit(&r->refs, 1, memory_order_relaxed);
+  }
+}
+
+/****************************************************************
+ * Returns true if something besides the engine's path to r     *
+ * owns r, in which case r must not change                      *
+ ****************************************************************/
+static bool snap_shared(struct snap_ref *r)
+{
+  return atomic_load_explicit(&r->refs, memory_order_acquire) > 1;
+}
+
+/****************************************************************
+ * Drops an owner of r, a node of height height or an image     *
+ * when height is negative.  The last owner frees r and drops   *
+ * its ownership of the slots of a node.                        *
+ ****************************************************************/
+static void snap_release(struct snap_ref *r, int height)
+{
+  if (r == NULL || atomic_fetch_sub_explicit(&r->refs, 1, memory_order_acq_rel) != 1) {
+    return;
+  }
+  if (height >= 0) {
+    struct snap_node *node = (struct snap_node *)r;
+
+    for (int i = 0; i < SNAP_FANOUT; i++) {
+      snap_release(node->slot[i], height - 1);
+    }
+  }
+  free(r);
+}
+
+/****************************************************************
+ * Returns the node at *link, of height height, for the engine  *
+ * to change.  A missing node is allocated and a shared one is  *
+ * copied, the copy sharing the slots of the original.          *
+ ****************************************************************/
+static struct snap_node *snap_node_own(struct snap_ref **link, int height)
+{
+  struct snap_node *node = (struct snap_node *)*link;
+
+  if (node != NULL && !snap_shared(&node->ref)) {
+    return node;
+  }
+
+  struct snap_node *copy = malloc(sizeof(struct snap_node));
+  if (copy == NULL) {
+    printf("ERROR: Unable to allocate a snapshot.\n");
+    exit(EXIT_FAILURE);
+  }
+  atomic_init(&copy->ref.refs, 1);
+  for (int i = 0; i < SNAP_FANOUT; i++) {
+    copy->slot[i] = (node != NULL) ? node->slot[i] : NULL;
+    snap_share(copy->slot[i]);
+  }
+  if (node != NULL) {
+    snap_release(&node->ref, height);
+  }
+  *link = &copy->ref;
+  return copy;
+}
+
+/****************************************************************
+ * Makes the snapshot tree hold the current state of fs, the    *
+ * schedule of city, or drop city when fs is NULL.  Must be     *
+ * called after every change to a schedule.                     *
+ ****************************************************************/
+static void snap_publish(struct flight_engine *fe, city_id_t city, const struct flight_schedule *fs)
+{
+  // grow the tree until it reaches city, the old root becomes the
+  // first child of the new one
+  while ((uint64_t)city >> (SNAP_BITS * (fe->snap_height + 1)) != 0) {
+    if (fe->snap_root != NULL) {
+      struct snap_ref *old = fe->snap_root;
+
+      fe->snap_root = NULL;
+      snap_node_own(&fe->snap_root, fe->snap_height + 1)->slot[0] = old;
+    }
+    fe->snap_height++;
+  }
+
+  struct snap_ref **link = &fe->snap_root;
+  for (int h = fe->snap_height; h >= 0; h--) {
+    struct snap_node *node = snap_node_own(link, h);
+    link = &node->slot[(city >> (SNAP_BITS * h)) & (SNAP_FANOUT - 1)];
+  }
+
+  struct snap_image *image = (struct snap_image *)*link;
+  if (fs == NULL || image == NULL || snap_shared(&image->ref)) {
+    snap_release(*link, -1);
+    *link = NULL;
+    if (fs == NULL) {
+      return;
+    }
+    image = malloc(sizeof(struct snap_image));
+    if (image == NULL) {
+      printf("ERROR: Unable to allocate a snapshot.\n");
+      exit(EXIT_FAILURE);
+    }
+    atomic_init(&image->ref.refs, 1);
+    strcpy(image->name, flight_city_name(fe, city));
+    *link = &image->ref;
+  }
+
+  image->count = 0;
+  for (int i = 0; i < MAX_FLIGHTS_PER_CITY; i++) {
+    if (fs->flights[i].time != TIME_NULL) {
+      image->flights[image->count] = fs->flights[i];
+      image->flights[image->count].seat_map = NULL;
+      image->count++;
+    }
+  }
+}
+
+/****************************************************************
+ * Returns a snapshot of the schedules of fe as they are now.   *
+ * It shares the whole of fe's snapshot tree so it takes the    *
+ * same time however many schedules there are.                  *
+ ****************************************************************/
+struct flight_snapshot *flight_snapshot_take(struct flight_engine *fe)
+{
+  struct flight_snapshot *snap = malloc(sizeof(struct flight_snapshot));
+
+  if (snap == NULL) {
+    printf("ERROR: Unable to allocate a snapshot.\n");
+    exit(EXIT_FAILURE);
+  }
+  snap_share(fe->snap_root);
+  snap->root = fe->snap_root;
+  snap->height = fe->snap_height;
+  snap->version = ++fe->snap_version;
+  snap->now = fe->time_index.now;
+  return snap;
+}
+
+/****************************************************************
+ * Frees a snapshot along with whatever part of the tree only   *
+ * it still shares                                              *
+ ****************************************************************/
+void flight_snapshot_release(struct flight_snapshot *snap)
+{
+  if (snap != NULL) {
+    snap_release(snap->root, snap->height);
+    free(snap);
+  }
+}
+
+/****************************************************************
+ * Returns the number of a snapshot, the first one an engine    *
+ * takes is 1                                                   *
+ ****************************************************************/
+uint64_t flight_snapshot_version(const struct flight_snapshot *snap)
+{
+  return snap->version;
+}
+
+/****************************************************************
+ * Returns the time of the clock when a snapshot was taken      *
+ ****************************************************************/
+flight_time_t flight_snapshot_clock(const struct flight_snapshot *snap)
+{
+  return snap->now;
+}
+
+/****************************************************************
+ * Returns the flights of city in snap in time order and sets   *
+ * *count to how many there are, or returns NULL if city had no *
+ * schedule when snap was taken                                 *
+ ****************************************************************/
+const struct flight *flight_snapshot_flights(const struct flight_snapshot *snap,
+                                             city_id_t city, int *count)
+{
+  const struct snap_ref *r = snap->root;
+
+  if ((uint64_t)city >> (SNAP_BITS * (snap->height + 1)) != 0) {
+    return NULL;
+  }
+  for (int h = snap->height; h >= 0 && r != NULL; h--) {
+    r = ((const struct snap_node *)r)->slot[(city >> (SNAP_BITS * h)) & (SNAP_FANOUT - 1)];
+  }
+  if (r == NULL) {
+    return NULL;
+  }
+
+  const struct snap_image *image = (const struct snap_image *)r;
+  *count = image->count;
+  return image->flights;
+}
+
+/****************************************************************
+ * Visits the images below r, a node of height height whose     *
+ * first city id is first, in city id order                     *
+ ****************************************************************/
+static void snap_visit(const struct snap_ref *r, int height, city_id_t first,
+                       flight_schedule_visit *visit, void *arg)
+{
+  if (r == NULL) {
+    return;
+  }
+  if (height < 0) {
+    const struct snap_image *image = (const struct snap_image *)r;
+
+    visit(arg, first, image->name, image->flights, image->count);
+    return;
+  }
+  for (int i = 0; i < SNAP_FANOUT; i++) {
+    snap_visit(((const struct snap_node *)r)->slot[i], height - 1,
+               first | ((city_id_t)i << (SNAP_BITS * height)), visit, arg);
+  }
+}
+
+/****************************************************************
+ * Visits every city that had a schedule when snap was taken    *
+ ****************************************************************/
+void flight_snapshot_visit(const struct flight_snapshot *snap,
+                           flight_schedule_visit *visit, void *arg)
+{
+  snap_visit(snap->root, snap->height, 0, visit, arg);
+}
+
+// What a fork is being built into
+struct snap_fork {
+  struct flight_engine *fe;
+  bool full;               // a city did not get a schedule
+};
+
+/****************************************************************
+ * Gives the fork a schedule with the flights of one city       *
+ ****************************************************************/
+static void snap_fork_city(void *arg, city_id_t city, const char *name,
+                           const struct flight *flights, int count)
+{
+  struct snap_fork *fork = arg;
+  struct flight_engine *fe = fork->fe;
+  struct flight_schedule *fs = flight_schedule_open(fe, flight_city_id(fe, name));
+
+  (void)city;
+  if (fs == NULL) {
+    fork->full = true;
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    fs->flights[i] = flights[i];
+    seat_map_create(fe, &fs->flights[i]);
+  }
+  flight_schedule_sort_flights_by_time(fe, fs);
+  time_index_attach(fe, fs);
+  snap_publish(fe, fs->destination, fs);
+}
+
+/****************************************************************
+ * Returns a new engine holding the schedules of snap, for what *
+ * if changes that must not touch the engine snap was taken     *
+ * from.  Booked seats of a flight are its lowest numbered ones *
+ * in its seat map.  Returns NULL if the engine cannot be       *
+ * created or has fewer than the schedules snap needs.          *
+ ****************************************************************/
+struct flight_engine *flight_snapshot_fork(const struct flight_snapshot *snap,
+                                           long schedules, bool seat_maps)
+{
+  struct snap_fork fork = { flight_engine_create(schedules, seat_maps), false };
+
+  if (fork.fe == NULL) {
+    return NULL;
+  }
+  fork.fe->time_index.now = snap->now;
+  flight_snapshot_visit(snap, snap_fork_city, &fork);
+  if (fork.full) {
+    flight_engine_destroy(fork.fe);
+    return NULL;
+  }
+  return fork.fe;
+}
@@ -0,0 +1,252 @@
+/**
+ * Flight engine: the schedules, time index, city names and seat maps of
+ * the flight management system as a library.  All the state lives in a
+ * struct flight_engine created with flight_engine_create so a program
+ * can hold several engines, one per thread or guarded by its own lock.
+ * Nothing here reads input or prints; assignment-3.c is the command line
+ * front end over it.
+ *
+ * Results are returned without copying: flights are const pointers into
+ * the engine that stay valid until the next call that changes the
+ * engine, and city names are owned by the engine for its lifetime.
+ *
+ * A snapshot is a read only version of the schedules taken in constant
+ * time.  It never changes, can be read and released on any thread while
+ * the engine goes on, and outlives the engine if need be.  Take
+ * snapshots on the thread that changes the engine.
+ *
+ * Build with -pthread, the bulk loader parses on several threads.
+ * Allocation failures print an ERROR line and exit like the rest of the
+ * programs of this course.
+ **/
+
+#ifndef FLIGHT_ENGINE_H
+#define FLIGHT_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Limit constants
+#define MAX_CITY_NAME_LEN 20
+#define MAX_FLIGHTS_PER_CITY 5
+
+// Time definitions.  A time is a minute counted from the start of day 0.
+#define MINUTES_PER_DAY (60 * 24)
+#define TIME_MIN 0
+#define TIME_MAX (MINUTES_PER_DAY - 1)   // last minute of a day
+#define TIME_NULL -1
+#define TIME_DAY(t) ((t) / MINUTES_PER_DAY)     // day of a time
+#define TIME_MINUTE(t) ((t) % MINUTES_PER_DAY)  // minute of the day of a time
+#define SCHEDULE_DAYS 64  // days ahead of the clock flights can depart on,
+                          // one bit each in the day wheel
+#define HOURS_PER_DAY 24
+
+// Seat map definitions.  Bits past the capacity in the last word of a
+// seat map are kept set so searches for free seats never see them.
+#define SEAT_WORD_BITS 64
+#define SEAT_WORDS(capacity) (((capacity) + SEAT_WORD_BITS - 1) / SEAT_WORD_BITS)
+#define SEAT_MAP_MAX_CAPACITY 65536   // most seats of a flight with a seat map
+
+typedef int flight_time_t;                 // minutes since day 0 began
+typedef char city_t[MAX_CITY_NAME_LEN+1];  // null terminate fixed length city
+typedef uint32_t city_id_t;                // interned city name
+#define CITY_ID_NULL UINT32_MAX
+
+// An engine and all of its schedules.  Only used through pointers.
+struct flight_engine;
+
+// A single flight.  The engine hands out const pointers to these.
+struct flight {
+  flight_time_t time;       // departure time of the flight
+  int available;  // number of seats currently available on the flight
+  int capacity;   // maximum seat capacity of the flight
+  uint64_t *seat_map;  // bit per seat, set when taken.  NULL without seat maps
+};
+
+// One request of a batch booking: reserve seats seats together on the
+// flight to city departing at time or the next closest time after it
+// that has enough seats.  slot and booked are filled in with the flight
+// booked.
+struct booking_request {
+  city_id_t city;  // destination city
+  flight_time_t time;     // earliest acceptable departure time
+  int seats;       // number of seats to reserve on one flight
+  int slot;        // index of the booked flight in the city's schedule
+  flight_time_t booked;   // departure time of the booked flight
+};
+
+// What an operation on the engine did.  Each failure matches one of the
+// messages of the command line front end.
+enum flight_status {
+  FLIGHT_OK,
+  FLIGHT_CITY_BAD,          // the city has no schedule
+  FLIGHT_CITY_EXISTS,       // the city already has a schedule
+  FLIGHT_NO_FREE_SCHEDULE,  // every schedule is in use
+  FLIGHT_MAX_FLIGHTS,       // the city's schedule is full
+  FLIGHT_TIME_BAD,          // the time is not on the schedule's days
+  FLIGHT_CAPACITY_BAD,      // the capacity is not positive or, with seat
+                            // maps, over SEAT_MAP_MAX_CAPACITY
+  FLIGHT_NO_FLIGHT,         // no flight departs at the time
+  FLIGHT_NO_SEATS,          // no flight at or after the time has a seat
+  FLIGHT_ALL_SEATS_EMPTY,   // nothing to unbook
+  FLIGHT_SEAT_MAPS_OFF,     // the engine keeps no seat maps
+  FLIGHT_NO_BLOCK,          // no block of adjacent free seats is that long
+  FLIGHT_SEAT_BAD,          // the seat is not taken
+};
+
+// Iterator over the cities that have a schedule, most recently added
+// first.  Start it with flight_cities_begin.
+struct flight_cities {
+  struct flight_engine *fe;
+  const void *next;    // next schedule to visit
+  uint64_t walked;     // schedules visited so far
+};
+
+// Iterator over the flights departing in a time range in time order.
+// Start it with flight_departures_begin.  Hours whose flights have fewer
+// seats available in total than asked for are skipped at once, but the
+// flights of any other hour are visited one by one, so a walk costs up
+// to the number of flights departing in the range however few match.
+struct flight_departures {
+  struct flight_engine *fe;
+  flight_time_t t;     // minute being walked or TIME_NULL when done
+  flight_time_t to;    // last minute of the range
+  int seats;           // fewest available seats of a flight returned
+  int h;               // next flight handle of minute t
+  uint64_t walked;     // flights visited so far
+};
+
+// Result of a bulk load
+struct flight_bulk_result {
+  long flights;   // flights loaded
+  long cities;    // cities that got flights
+  long skipped;   // rows that were bad or did not fit
+};
+
+// Called for each city found by a name search with the edit distance of
+// its name, always 0 for a prefix search
+typedef void flight_city_visit(void *arg, city_id_t city, int distance);
+
+// A read only version of the schedules.  Only used through pointers.
+struct flight_snapshot;
+
+// Called for each city of a snapshot with its flights in time order.
+// The flights have no seat maps.
+typedef void flight_schedule_visit(void *arg, city_id_t city, const char *name,
+                                   const struct flight *flights, int count);
+
+// Log-linear (HDR style) histogram.  Values below STATS_SUB_BUCKETS get a
+// bucket each, above that every power of 2 is split into
+// STATS_SUB_BUCKETS buckets so a bucket is within about 6% of its values.
+#define STATS_SUB_BITS 4                       // 16 sub-buckets per power of 2
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+struct stats_histogram {
+  uint64_t count;                    // number of values recorded
+  uint64_t sum;                      // sum of the values recorded
+  uint64_t max;                      // largest value recorded
+  uint64_t buckets[STATS_BUCKETS];   // number of values in each bucket
+};
+
+void stats_record(struct stats_histogram *h, uint64_t value);
+uint64_t stats_percentile(const struct stats_histogram *h, double q);
+
+#ifdef FLIGHT_STATS
+// Operations timed inside the engine
+enum stats_op { STATS_OP_FIND, STATS_OP_SORT, STATS_OPS };
+
+// Lists whose walk lengths are recorded
+enum stats_walk { STATS_WALK_ACTIVE, STATS_WALK_DEPARTURES, STATS_WALKS };
+
+// Everything an engine measures.  Times are in cycles of the cpu's cycle
+// counter.
+struct flight_stats {
+  struct stats_histogram op[STATS_OPS];            // find, sort
+  struct stats_histogram walk[STATS_WALKS];        // nodes visited per walk
+  long free_depth;                                 // schedules on free list
+  long free_depth_min;                             // fewest ever free
+};
+
+uint64_t stats_cycles(void);
+
+// Instrumentation hooks.  They compile to nothing without FLIGHT_STATS.
+#define STATS_START(t)      uint64_t t = stats_cycles()
+#define STATS_STOP(h, t)    stats_record(&(h), stats_cycles() - (t))
+#define STATS_RECORD(h, v)  stats_record(&(h), (v))
+#else
+#define STATS_START(t)
+#define STATS_STOP(h, t)
+#define STATS_RECORD(h, v)
+#endif
+
+// Engines
+struct flight_engine *flight_engine_create(long schedules, bool seat_maps);
+void flight_engine_destroy(struct flight_engine *fe);
+#ifdef FLIGHT_STATS
+const struct flight_stats *flight_engine_stats(const struct flight_engine *fe);
+#endif
+
+// Cities
+city_id_t flight_city_id(struct flight_engine *fe, const char *name);
+city_id_t flight_city_find(const struct flight_engine *fe, const char *name);
+const char *flight_city_name(const struct flight_engine *fe, city_id_t city);
+bool flight_city_active(struct flight_engine *fe, city_id_t city);
+enum flight_status flight_city_add(struct flight_engine *fe, city_id_t city);
+enum flight_status flight_city_remove(struct flight_engine *fe, city_id_t city);
+const struct flight *flight_city_flights(struct flight_engine *fe,
+                                         city_id_t city, int *count);
+void flight_cities_begin(struct flight_engine *fe, struct flight_cities *it);
+city_id_t flight_cities_next(struct flight_cities *it);
+void flight_cities_prefix(struct flight_engine *fe, const char *prefix,
+                          flight_city_visit *visit, void *arg);
+void flight_cities_similar(struct flight_engine *fe, const char *name,
+                           int max_distance, flight_city_visit *visit, void *arg);
+
+// Flights and bookings
+enum flight_status flight_add(struct flight_engine *fe, city_id_t city,
+                              flight_time_t time, int capacity);
+enum flight_status flight_remove(struct flight_engine *fe, city_id_t city,
+                                 flight_time_t time);
+enum flight_status flight_book(struct flight_engine *fe, city_id_t city,
+                               flight_time_t time, const struct flight **booked);
+enum flight_status flight_unbook(struct flight_engine *fe, city_id_t city,
+                                 flight_time_t time);
+int flight_book_batch(struct flight_engine *fe, struct booking_request reqs[], int n);
+enum flight_status flight_bulk_load(struct flight_engine *fe, const char *data,
+                                    size_t size, struct flight_bulk_result *result);
+
+// Seat maps
+enum flight_status flight_seat_flight(struct flight_engine *fe, city_id_t city,
+                                      flight_time_t time, const struct flight **f);
+bool flight_seat_taken(const struct flight *f, int seat);
+enum flight_status flight_seats_book_block(struct flight_engine *fe, city_id_t city,
+                                           flight_time_t time, int seats, int *first);
+enum flight_status flight_seat_release(struct flight_engine *fe, city_id_t city,
+                                       flight_time_t time, int seat);
+enum flight_status flight_seats_release_all(struct flight_engine *fe, city_id_t city,
+                                            flight_time_t time);
+
+// Time
+flight_time_t flight_clock(const struct flight_engine *fe);
+bool flight_time_valid(const struct flight_engine *fe, flight_time_t time);
+int flight_clock_advance(struct flight_engine *fe, flight_time_t to);
+void flight_departures_begin(struct flight_engine *fe, struct flight_departures *it,
+                             flight_time_t from, flight_time_t to, int seats);
+const struct flight *flight_departures_next(struct flight_departures *it, city_id_t *city);
+long flight_hour_seats(const struct flight_engine *fe, int hour);
+
+// Snapshots.  City ids are the ones of the engine the snapshot was taken
+// from, a fork hands out its own.
+struct flight_snapshot *flight_snapshot_take(struct flight_engine *fe);
+void flight_snapshot_release(struct flight_snapshot *snap);
+uint64_t flight_snapshot_version(const struct flight_snapshot *snap);
+flight_time_t flight_snapshot_clock(const struct flight_snapshot *snap);
+const struct flight *flight_snapshot_flights(const struct flight_snapshot *snap,
+                                             city_id_t city, int *count);
+void flight_snapshot_visit(const struct flight_snapshot *snap,
+                           flight_schedule_visit *visit, void *arg);
+struct flight_engine *flight_snapshot_fork(const struct flight_snapshot *snap,
+                                           long schedules, bool seat_maps);
+
+#endif